@@ -1,11 +1,18 @@
 ﻿#include <iostream>
 #include <cstdlib>
 #include <string>
+#include <vector>
 
 #include <boost/json.hpp>
 #include "bserv/common.hpp"
 
 #include "rendering.h"
+#include "static_files.h"
+#include "image_variants.h"
+#include "compression.h"
+#include "migrations.h"
+#include "read_pool.h"
+#include "search_index.h"
 #include "handlers.h"
 
 void show_usage(const bserv::server_config& config) {
@@ -53,12 +60,55 @@ int main(int argc, char* argv[]) {
 				std::cerr << "`template_root` must be specified" << std::endl;
 				return EXIT_FAILURE;
 			}
-			else init_rendering(config_obj["template_root"].as_string().c_str());
+			else init_rendering(config_obj["template_root"].as_string().c_str(),
+				config_obj.contains("template-watch") && config_obj["template-watch"].as_bool());
+			set_response_compression(
+				config_obj.contains("gzip-min-size")
+					? (std::size_t)config_obj["gzip-min-size"].as_int64() : 1024,
+				config_obj.contains("gzip-level")
+					? (int)config_obj["gzip-level"].as_int64() : 6);
 			if (!config_obj.contains("static_root")) {
 				std::cerr << "`static_root` must be specified" << std::endl;
 				return EXIT_FAILURE;
 			}
-			else init_static_root(config_obj["static_root"].as_string().c_str());
+			else init_static_root(config_obj["static_root"].as_string().c_str(),
+				config_obj.contains("static-cache-size")
+					? (std::size_t)config_obj["static-cache-size"].as_int64() : 64 * 1024 * 1024,
+				config_obj.contains("static-max-age")
+					? (int)config_obj["static-max-age"].as_int64() : 3600,
+				config_obj.contains("static-large-file-size")
+					? (std::size_t)config_obj["static-large-file-size"].as_int64() : 1024 * 1024);
+			if (config_obj.contains("image-widths")) {
+				std::vector<int> widths;
+				for (const auto& width : config_obj["image-widths"].as_array())
+					widths.push_back((int)width.as_int64());
+				init_image_variants(config_obj["static_root"].as_string().c_str(), widths);
+			}
+			else init_image_variants(config_obj["static_root"].as_string().c_str());
+			// "conn-num-ro-max" above "conn-num-ro" lets the read pool
+			// open connections while requests wait for one. a replica
+			// ("conn-str-ro") gets "conn-num" of them by default. without
+			// one the read pool connects to the primary, with 2 by
+			// default: the server then holds up to "conn-num" plus
+			// "conn-num-ro-max" connections to the primary.
+			bool read_replica = config_obj.contains("conn-str-ro");
+			int read_conn_num = config_obj.contains("conn-num-ro")
+				? (int)config_obj["conn-num-ro"].as_int64()
+				: read_replica ? config.get_num_db_conn() : 2;
+			init_read_pool(
+				read_replica
+					? config_obj["conn-str-ro"].as_string().c_str() : config.get_db_conn_str(),
+				read_conn_num,
+				config_obj.contains("conn-num-ro-max")
+					? (int)config_obj["conn-num-ro-max"].as_int64() : read_conn_num);
+			if (!config_obj.contains("migrate") || config_obj["migrate"].as_bool())
+				run_migrations(config.get_db_conn_str());
+			// the menu pages are answered from memory, checked against
+			// the database every "menu-check-interval" seconds.
+			init_reference_data(read_connection(), load_reference_data, load_menu_dish,
+				config_obj.contains("menu-check-interval")
+					? (int)config_obj["menu-check-interval"].as_int64() : 300);
+			init_search_index(read_connection());
 		}
 		catch (const std::exception& e) {
 			std::cerr << e.what() << std::endl;
@@ -92,16 +142,34 @@ int main(int argc, char* argv[]) {
 			bserv::placeholders::json_params),
 		bserv::make_path("/echo", &echo,
 			bserv::placeholders::json_params),
+		bserv::make_path("/metrics", &view_metrics,
+			bserv::placeholders::session),
+		bserv::make_path("/dish_suggest", &suggest_dishes,
+			bserv::placeholders::json_params),
+		bserv::make_path("/search_api", &search_api,
+			bserv::placeholders::json_params),
 
 		// serving static files
 		bserv::make_path("/statics/<path>", &serve_static_files,
+			bserv::placeholders::request,
 			bserv::placeholders::response,
 			bserv::placeholders::_1),
+		// resized jpeg images, /thumbs/<width>/<path under statics>
+		bserv::make_path("/thumbs/<int>/<path>", &serve_image,
+			bserv::placeholders::request,
+			bserv::placeholders::response,
+			bserv::placeholders::_1,
+			bserv::placeholders::_2),
 
 		// serving html template files
 		bserv::make_path("/", &index_page,
-			bserv::placeholders::db_connection_ptr,
 			bserv::placeholders::session,
+			bserv::placeholders::request,
+			bserv::placeholders::response),
+		bserv::make_path("/search", &search_page,
+			bserv::placeholders::json_params,
+			bserv::placeholders::session,
+			bserv::placeholders::request,
 			bserv::placeholders::response),
 		bserv::make_path("/form_login", &form_login,
 			bserv::placeholders::request,
@@ -112,68 +180,69 @@ int main(int argc, char* argv[]) {
 		bserv::make_path("/form_logout", &form_logout,
 			bserv::placeholders::db_connection_ptr,
 			bserv::placeholders::session,
+			bserv::placeholders::request,
 			bserv::placeholders::response),
 		bserv::make_path("/users", &view_users,
-			bserv::placeholders::db_connection_ptr,
 			bserv::placeholders::session,
+			bserv::placeholders::request,
 			bserv::placeholders::response,
 			std::string{"1"}),
 		bserv::make_path("/canteen_management", &canteen_management,
-			bserv::placeholders::db_connection_ptr,
 			bserv::placeholders::session,
+			bserv::placeholders::request,
 			bserv::placeholders::response,
 			std::string{"1"}),
 		bserv::make_path("/window_management", &window_management,
-			bserv::placeholders::db_connection_ptr,
 			bserv::placeholders::session,
+			bserv::placeholders::request,
 			bserv::placeholders::response,
 			std::string{"1"}),
 		bserv::make_path("/dish_management", &dish_management,
-			bserv::placeholders::db_connection_ptr,
 			bserv::placeholders::json_params,
 			bserv::placeholders::session,
+			bserv::placeholders::request,
 			bserv::placeholders::response,
 			std::string{"1"}),
 		bserv::make_path("/tag_management", &tag_management,
-			bserv::placeholders::db_connection_ptr,
 			bserv::placeholders::session,
+			bserv::placeholders::request,
 			bserv::placeholders::response,
 			std::string{"1"}),
 		bserv::make_path("/dish_tag/<int>", &dish_tag,
-			bserv::placeholders::db_connection_ptr,
 			bserv::placeholders::session,
+			bserv::placeholders::request,
 			bserv::placeholders::response,
 			bserv::placeholders::_1,
 			std::string{"1"}),
 		bserv::make_path("/users/<int>", &view_users,
-			bserv::placeholders::db_connection_ptr,
 			bserv::placeholders::session,
+			bserv::placeholders::request,
 			bserv::placeholders::response,
 			bserv::placeholders::_1),
 		bserv::make_path("/canteen_management/<int>", &canteen_management,
-			bserv::placeholders::db_connection_ptr,
 			bserv::placeholders::session,
+			bserv::placeholders::request,
 			bserv::placeholders::response,
 			bserv::placeholders::_1),
 		bserv::make_path("/window_management/<int>", &window_management,
-			bserv::placeholders::db_connection_ptr,
 			bserv::placeholders::session,
+			bserv::placeholders::request,
 			bserv::placeholders::response,
 			bserv::placeholders::_1),
 		bserv::make_path("/dish_management/<int>", &dish_management,
-			bserv::placeholders::db_connection_ptr,
 			bserv::placeholders::json_params,
 			bserv::placeholders::session,
+			bserv::placeholders::request,
 			bserv::placeholders::response,
 			bserv::placeholders::_1),
 		bserv::make_path("/dish_management/<int>", &tag_management,
-			bserv::placeholders::db_connection_ptr,
 			bserv::placeholders::session,
+			bserv::placeholders::request,
 			bserv::placeholders::response,
 			bserv::placeholders::_1),
 		bserv::make_path("/dish_tag/<int>/<int>", &dish_tag,
-			bserv::placeholders::db_connection_ptr,
 			bserv::placeholders::session,
+			bserv::placeholders::request,
 			bserv::placeholders::response,
 			bserv::placeholders::_1,
 			bserv::placeholders::_2),
@@ -280,6 +349,15 @@ int main(int argc, char* argv[]) {
 			bserv::placeholders::json_params,
 			bserv::placeholders::db_connection_ptr,
 			bserv::placeholders::session),
+		bserv::make_path("/menu_import", &import_menu,
+			bserv::placeholders::request,
+			bserv::placeholders::db_connection_ptr,
+			bserv::placeholders::session),
+		// the whole csv is held in the response body, bounded by the menu size
+		bserv::make_path("/menu_export", &export_menu,
+			bserv::placeholders::session,
+			bserv::placeholders::request,
+			bserv::placeholders::response),
 
 		bserv::make_path("/<int>/<int>/<int>/<int>/form_add_remark", &form_add_remark,
 			bserv::placeholders::request,
@@ -293,16 +371,16 @@ int main(int argc, char* argv[]) {
 			bserv::placeholders::_4),
 
 		bserv::make_path("/<int>/<int>/<int>/manu", &canteen_index,
-			bserv::placeholders::db_connection_ptr,
 			bserv::placeholders::json_params,
 			bserv::placeholders::session,
+			bserv::placeholders::request,
 			bserv::placeholders::response,
 			bserv::placeholders::_1,
 			bserv::placeholders::_2,
 			bserv::placeholders::_3),
 		bserv::make_path("/<int>/<int>/<int>/<int>/dish", &dish_content,
-			bserv::placeholders::db_connection_ptr,
 			bserv::placeholders::session,
+			bserv::placeholders::request,
 			bserv::placeholders::response,
 			bserv::placeholders::_1,
 			bserv::placeholders::_2,
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <cstddef>
+#include <cstdint>
+
+#include <boost/json.hpp>
+
+// templates compiled to C++ by `template_compiler` (see CMakeLists.txt,
+// option WEBAPP_COMPILED_TEMPLATES). a compiled template appends the
+// page to `out` and produces the same html as inja would.
+using compiled_template = void (*)(
+	std::string& out,
+	const boost::json::object& context);
+
+// returns nullptr if `template_file` was not compiled.
+compiled_template find_compiled_template(const std::string& template_file);
+
+// helpers used by the generated code. reads throw
+// std::runtime_error for missing variables, like inja does.
+namespace compiled {
+
+	// the member `name`, null if `object` is null, not an object or
+	// has no such member. the context paths are found with these once
+	// per render.
+	const boost::json::value* find(const boost::json::object& object, std::string_view name);
+	const boost::json::value* find(const boost::json::value* object, std::string_view name);
+
+	// `*value`, which must have been found.
+	const boost::json::value& deref(const boost::json::value* value, const char* path);
+
+	// the first row of `array`, null if it is empty.
+	const boost::json::value* first(const boost::json::array& array);
+
+	// where member `name` is in `row`, npos if it is not there.
+	std::size_t position(const boost::json::value* row, std::string_view name);
+
+	// the member at `position` of `row`, null if there is none.
+	const boost::json::value* child(const boost::json::value* row, std::size_t position);
+
+	// the member `name` of a row, read at `position` (from the first
+	// row) if the row has `name` there. a row laid out differently
+	// has it looked up.
+	const boost::json::value& member(
+		const boost::json::value& value,
+		std::size_t position,
+		std::string_view name,
+		const char* path);
+
+	const boost::json::array& as_array(
+		const boost::json::value& value,
+		const char* path);
+
+	// `at(path, index)`
+	const boost::json::value& at(
+		const boost::json::value& value,
+		std::int64_t index,
+		const char* path);
+
+	// `existsIn(path, "key")` of a context path, found as `object`
+	// and its `member`.
+	bool exists_in(
+		const boost::json::value* object,
+		const boost::json::value* member,
+		const char* path);
+
+	// `existsIn(row, "key")` of a loop variable.
+	bool exists_in(
+		const boost::json::value& value,
+		std::size_t position,
+		std::string_view key);
+
+	bool truthy(const boost::json::value& value);
+
+	void write(std::string& out, const boost::json::value& value);
+	void write(std::string& out, std::int64_t value);
+	void write(std::string& out, bool value);
+
+} // compiled
@@ -0,0 +1,299 @@
+#include "compiled_templates.h"
+
+#include <charconv>
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+
+namespace compiled {
+
+	namespace {
+
+		[[noreturn]] void not_found(std::string_view path) {
+			throw std::runtime_error{ "variable '" + std::string{ path } + "' not found" };
+		}
+
+		// the member `name` of `obj`, at `position` if it is there.
+		const boost::json::value* find_at(
+			const boost::json::object& obj,
+			std::size_t position,
+			std::string_view name) {
+			if (position < obj.size() && obj.begin()[position].key() == name)
+				return &obj.begin()[position].value();
+			auto it = obj.find(name);
+			return it == obj.end() ? nullptr : &it->value();
+		}
+
+		// nlohmann::json::dump() formatting of a double, which is
+		// what inja prints for floating point values.
+		void write_double(std::string& out, double value) {
+			if (!std::isfinite(value)) {
+				out += "null";
+				return;
+			}
+			if (value == 0) {
+				out += std::signbit(value) ? "-0.0" : "0.0";
+				return;
+			}
+			char buf[64];
+			auto res = std::to_chars(buf, buf + sizeof(buf), value, std::chars_format::scientific);
+			std::string sci{ buf, res.ptr };
+			if (sci[0] == '-') {
+				out += '-';
+				sci.erase(0, 1);
+			}
+			auto e = sci.find('e');
+			std::string digits = sci.substr(0, 1);
+			if (e > 1)
+				digits += sci.substr(2, e - 2);
+			int k = (int)digits.size();
+			int n = std::stoi(sci.substr(e + 1)) + 1;
+			if (k <= n && n <= 15) {
+				out += digits;
+				out.append(n - k, '0');
+				out += ".0";
+			}
+			else if (0 < n && n <= 15) {
+				out.append(digits, 0, n);
+				out += '.';
+				out.append(digits, n, std::string::npos);
+			}
+			else if (-4 < n && n <= 0) {
+				out += "0.";
+				out.append(-n, '0');
+				out += digits;
+			}
+			else {
+				out += digits[0];
+				if (k > 1) {
+					out += '.';
+					out.append(digits, 1, std::string::npos);
+				}
+				int exponent = n - 1;
+				out += exponent < 0 ? "e-" : "e+";
+				exponent = std::abs(exponent);
+				if (exponent < 10) out += '0';
+				out += std::to_string(exponent);
+			}
+		}
+
+		void dump_string(std::string& out, const boost::json::string& str) {
+			out += '"';
+			for (unsigned char c : str) {
+				switch (c) {
+				case '"': out += "\\\""; break;
+				case '\\': out += "\\\\"; break;
+				case '\b': out += "\\b"; break;
+				case '\f': out += "\\f"; break;
+				case '\n': out += "\\n"; break;
+				case '\r': out += "\\r"; break;
+				case '\t': out += "\\t"; break;
+				default:
+					if (c < 0x20) {
+						char buf[8];
+						std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+						out += buf;
+					}
+					else {
+						out += static_cast<char>(c);
+					}
+				}
+			}
+			out += '"';
+		}
+
+		// nlohmann::json::dump(), objects have their keys sorted.
+		void dump(std::string& out, const boost::json::value& value) {
+			switch (value.kind()) {
+			case boost::json::kind::null:
+				out += "null";
+				break;
+			case boost::json::kind::bool_:
+				out += value.as_bool() ? "true" : "false";
+				break;
+			case boost::json::kind::int64:
+				out += std::to_string(value.as_int64());
+				break;
+			case boost::json::kind::uint64:
+				out += std::to_string(value.as_uint64());
+				break;
+			case boost::json::kind::double_:
+				write_double(out, value.as_double());
+				break;
+			case boost::json::kind::string:
+				dump_string(out, value.as_string());
+				break;
+			case boost::json::kind::array: {
+				out += '[';
+				bool first = true;
+				for (const auto& item : value.as_array()) {
+					if (!first) out += ',';
+					first = false;
+					dump(out, item);
+				}
+				out += ']';
+				break;
+			}
+			case boost::json::kind::object: {
+				const auto& obj = value.as_object();
+				std::vector<std::pair<std::string, const boost::json::value*>> items;
+				for (const auto& item : obj)
+					items.emplace_back(std::string{ item.key() }, &item.value());
+				std::sort(items.begin(), items.end(),
+					[](const auto& a, const auto& b) { return a.first < b.first; });
+				out += '{';
+				bool first = true;
+				for (const auto& item : items) {
+					if (!first) out += ',';
+					first = false;
+					dump_string(out, boost::json::string{ item.first });
+					out += ':';
+					dump(out, *item.second);
+				}
+				out += '}';
+				break;
+			}
+			}
+		}
+
+	} // namespace
+
+	const boost::json::value* find(const boost::json::object& object, std::string_view name) {
+		auto it = object.find(name);
+		return it == object.end() ? nullptr : &it->value();
+	}
+
+	const boost::json::value* find(const boost::json::value* object, std::string_view name) {
+		const boost::json::object* obj = object ? object->if_object() : nullptr;
+		return obj ? find(*obj, name) : nullptr;
+	}
+
+	const boost::json::value& deref(const boost::json::value* value, const char* path) {
+		if (value == nullptr)
+			not_found(path);
+		return *value;
+	}
+
+	const boost::json::value* first(const boost::json::array& array) {
+		return array.empty() ? nullptr : &array[0];
+	}
+
+	std::size_t position(const boost::json::value* row, std::string_view name) {
+		const boost::json::object* obj = row ? row->if_object() : nullptr;
+		if (obj == nullptr)
+			return std::string_view::npos;
+		auto it = obj->find(name);
+		return it == obj->end() ? std::string_view::npos : (std::size_t)(it - obj->begin());
+	}
+
+	const boost::json::value* child(const boost::json::value* row, std::size_t position) {
+		const boost::json::object* obj = row ? row->if_object() : nullptr;
+		if (obj == nullptr || position >= obj->size())
+			return nullptr;
+		return &obj->begin()[position].value();
+	}
+
+	const boost::json::value& member(
+		const boost::json::value& value,
+		std::size_t position,
+		std::string_view name,
+		const char* path) {
+		const boost::json::object* obj = value.if_object();
+		const boost::json::value* result = obj ? find_at(*obj, position, name) : nullptr;
+		if (result == nullptr)
+			not_found(path);
+		return *result;
+	}
+
+	const boost::json::array& as_array(
+		const boost::json::value& value,
+		const char* path) {
+		const boost::json::array* arr = value.if_array();
+		if (arr == nullptr)
+			throw std::runtime_error{ std::string{ "'" } + path + "' is not an array" };
+		return *arr;
+	}
+
+	const boost::json::value& at(
+		const boost::json::value& value,
+		std::int64_t index,
+		const char* path) {
+		const boost::json::array& arr = as_array(value, path);
+		if (index < 0 || (std::size_t)index >= arr.size())
+			throw std::runtime_error{ std::string{ "index " } + std::to_string(index) + " out of range of '" + path + "'" };
+		return arr[(std::size_t)index];
+	}
+
+	bool exists_in(
+		const boost::json::value* object,
+		const boost::json::value* member,
+		const char* path) {
+		deref(object, path);
+		return member != nullptr;
+	}
+
+	bool exists_in(
+		const boost::json::value& value,
+		std::size_t position,
+		std::string_view key) {
+		const boost::json::object* obj = value.if_object();
+		return obj != nullptr && find_at(*obj, position, key) != nullptr;
+	}
+
+	// inja's truthy: json::empty() is false for any string, so an
+	// empty string is true too.
+	bool truthy(const boost::json::value& value) {
+		switch (value.kind()) {
+		case boost::json::kind::null:
+			return false;
+		case boost::json::kind::bool_:
+			return value.as_bool();
+		case boost::json::kind::int64:
+			return value.as_int64() != 0;
+		case boost::json::kind::uint64:
+			return value.as_uint64() != 0;
+		case boost::json::kind::double_:
+			return value.as_double() != 0;
+		case boost::json::kind::string:
+			return true;
+		case boost::json::kind::array:
+			return !value.as_array().empty();
+		case boost::json::kind::object:
+			return !value.as_object().empty();
+		}
+		return false;
+	}
+
+	// mirrors inja's print: strings are written raw, integers in
+	// decimal, null as nothing, anything else as json.
+	void write(std::string& out, const boost::json::value& value) {
+		switch (value.kind()) {
+		case boost::json::kind::null:
+			break;
+		case boost::json::kind::string: {
+			const auto& str = value.as_string();
+			out.append(str.data(), str.size());
+			break;
+		}
+		case boost::json::kind::int64:
+			out += std::to_string(value.as_int64());
+			break;
+		case boost::json::kind::uint64:
+			out += std::to_string(static_cast<std::int64_t>(value.as_uint64()));
+			break;
+		default:
+			dump(out, value);
+		}
+	}
+
+	void write(std::string& out, std::int64_t value) {
+		out += std::to_string(value);
+	}
+
+	void write(std::string& out, bool value) {
+		out += value ? "true" : "false";
+	}
+
+} // compiled
@@ -0,0 +1,124 @@
+#include "compression.h"
+#include "metrics.h"
+
+#include <cctype>
+#include <cstdlib>
+#include <cstdint>
+
+#include <zlib.h>
+
+std::size_t compress_min_size_ = 1024;
+int compress_level_ = 6;
+
+bool accepts_gzip(const bserv::request_type& request) {
+	auto field = request.find(bserv::http::field::accept_encoding);
+	if (field == request.end())
+		return false;
+	std::string header{ field->value() };
+	for (auto& c : header)
+		c = (char)std::tolower((unsigned char)c);
+	bool star = false;
+	std::size_t pos = 0;
+	while (pos < header.size()) {
+		std::size_t end = header.find(',', pos);
+		if (end == std::string::npos) end = header.size();
+		std::string item = header.substr(pos, end - pos);
+		pos = end + 1;
+		std::size_t semi = item.find(';');
+		std::string coding = item.substr(0, semi);
+		coding.erase(0, coding.find_first_not_of(" \t"));
+		coding.erase(coding.find_last_not_of(" \t") + 1);
+		bool allowed = true;
+		if (semi != std::string::npos) {
+			std::size_t q = item.find("q=", semi);
+			if (q != std::string::npos)
+				allowed = std::atof(item.c_str() + q + 2) > 0;
+		}
+		if (coding == "gzip" || coding == "x-gzip")
+			return allowed;
+		if (coding == "*")
+			star = allowed;
+	}
+	return star;
+}
+
+// one per io thread. deflateReset keeps the ~256 KiB of zlib
+// state around, so responses do not allocate a new compressor.
+class deflate_stream {
+public:
+	~deflate_stream() {
+		if (initialized_)
+			deflateEnd(&stream_);
+	}
+
+	bool compress(const std::string& in, std::string& out, int level) {
+		if (initialized_ && level != level_) {
+			deflateEnd(&stream_);
+			initialized_ = false;
+		}
+		if (!initialized_) {
+			stream_ = z_stream{};
+			if (deflateInit2(&stream_, level, Z_DEFLATED,
+				15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+				return false;
+			initialized_ = true;
+			level_ = level;
+		}
+		else {
+			deflateReset(&stream_);
+		}
+		out.resize(deflateBound(&stream_, (uLong)in.size()));
+		stream_.next_in = (Bytef*)in.data();
+		stream_.avail_in = (uInt)in.size();
+		stream_.next_out = (Bytef*)out.data();
+		stream_.avail_out = (uInt)out.size();
+		int res = deflate(&stream_, Z_FINISH);
+		out.resize(stream_.total_out);
+		return res == Z_STREAM_END;
+	}
+
+private:
+	z_stream stream_{};
+	bool initialized_ = false;
+	int level_ = 0;
+};
+
+void set_response_compression(std::size_t min_size, int level) {
+	compress_min_size_ = min_size;
+	compress_level_ = level;
+}
+
+void compress_response(
+	const bserv::request_type& request,
+	bserv::response_type& response) {
+	static metric_counter& responses = get_counter("gzip.responses");
+	static metric_counter& bytes_in = get_counter("gzip.bytes_in");
+	static metric_counter& bytes_out = get_counter("gzip.bytes_out");
+	static metric_counter& cpu_ns = get_counter("gzip.cpu_ns");
+	static bool registered = (register_gauge("gzip.ratio", [] {
+		std::uint64_t out = bytes_out.get();
+		return out == 0 ? 0.0 : (double)bytes_in.get() / out;
+	}), true);
+	(void)registered;
+
+	if (response.body().size() < compress_min_size_
+		|| response.find(bserv::http::field::content_encoding) != response.end())
+		return;
+	response.set(bserv::http::field::vary, "Accept-Encoding");
+	if (!accepts_gzip(request))
+		return;
+	thread_local deflate_stream stream;
+	// swapped with the body, so it ends up holding the previous
+	// body's memory for the next response.
+	thread_local std::string buffer;
+	std::uint64_t start = thread_cpu_time_ns();
+	if (!stream.compress(response.body(), buffer, compress_level_))
+		return;
+	cpu_ns.add(thread_cpu_time_ns() - start);
+	responses.add();
+	bytes_in.add(response.body().size());
+	bytes_out.add(buffer.size());
+	response.body().swap(buffer);
+	response.set(bserv::http::field::content_encoding, "gzip");
+	response.prepare_payload();
+}
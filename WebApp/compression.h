@@ -0,0 +1,17 @@
+#pragma once
+
+#include <string>
+
+#include "bserv/common.hpp"
+
+// true if `Accept-Encoding` lists gzip (or `*`) with a non-zero q-value.
+bool accepts_gzip(const bserv::request_type& request);
+
+// responses smaller than `min_size` bytes are sent as they are.
+void set_response_compression(std::size_t min_size, int level);
+
+// gzip encodes the body of `response` in place if it is large
+// enough and the client accepts it.
+void compress_response(
+	const bserv::request_type& request,
+	bserv::response_type& response);
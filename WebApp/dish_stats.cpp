@@ -0,0 +1,58 @@
+#include "dish_stats.h"
+
+#include <algorithm>
+
+namespace {
+
+	// the index of the bucket of `score` in the 1-based sql array.
+	int bucket_index(int score) {
+		return std::min(std::max(score, 0), 99) / 10 + 1;
+	}
+
+} // namespace
+
+void add_dish_score(bserv::db_transaction& tx, int dish_id, int score) {
+	int bucket = bucket_index(score);
+	// a new row gets a histogram with only `bucket` set
+	bserv::db_result r = tx.exec(
+		"insert into dish_stats (D_, remarks, score_sum, histogram) values (?, 1, ?, "
+		"array_fill(0, array[?::integer]) || 1 || array_fill(0, array[?::integer])) "
+		"on conflict (D_) do update set remarks = dish_stats.remarks + 1, "
+		"score_sum = dish_stats.score_sum + excluded.score_sum, "
+		"histogram[?] = dish_stats.histogram[?] + 1;",
+		dish_id, score, bucket - 1, dish_stats_buckets - bucket, bucket, bucket);
+	lginfo << r.query();
+}
+
+void remove_dish_score(bserv::db_transaction& tx, int dish_id, int score) {
+	int bucket = bucket_index(score);
+	bserv::db_result r = tx.exec(
+		"update dish_stats set remarks = remarks - 1, score_sum = score_sum - ?, "
+		"histogram[?] = histogram[?] - 1 where D_ = ?;", score, bucket, bucket, dish_id);
+	lginfo << r.query();
+}
+
+dish_stats to_dish_stats(const pqxx::result& result) {
+	dish_stats stats;
+	if (result.empty())
+		return stats;
+	auto row = result[0];
+	stats.remarks = row[0].as<int>();
+	stats.score_sum = row[1].as<long long>();
+	for (int i = 0; i < dish_stats_buckets; ++i)
+		stats.histogram[i] = row[2 + i].as<int>();
+	return stats;
+}
+
+boost::json::array histogram_to_json(const dish_stats& stats) {
+	boost::json::array histogram;
+	for (int i = 0; i < dish_stats_buckets; ++i) {
+		boost::json::object bucket;
+		bucket["low"] = i * 10;
+		bucket["high"] = i + 1 == dish_stats_buckets ? 100 : i * 10 + 9;
+		bucket["count"] = stats.histogram[i];
+		bucket["percent"] = stats.remarks == 0 ? 0 : stats.histogram[i] * 100 / stats.remarks;
+		histogram.push_back(bucket);
+	}
+	return histogram;
+}
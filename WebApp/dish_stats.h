@@ -0,0 +1,32 @@
+#pragma once
+
+#include <pqxx/pqxx>
+#include <boost/json.hpp>
+#include "bserv/common.hpp"
+
+// the scores of a dish, 0~100, in buckets of 10 (the last one
+// holds 90~100).
+constexpr int dish_stats_buckets = 10;
+
+// the remark count, score sum and histogram kept in `dish_stats`.
+// they are updated with each remark, in its transaction, so the
+// dish page does not aggregate the remarks.
+struct dish_stats {
+	int remarks = 0;
+	long long score_sum = 0;
+	int histogram[dish_stats_buckets] = {};
+};
+
+// counts a remark with `score` for `dish_id`.
+void add_dish_score(bserv::db_transaction& tx, int dish_id, int score);
+
+// takes back a remark with `score` for `dish_id`.
+void remove_dish_score(bserv::db_transaction& tx, int dish_id, int score);
+
+// reads the result of `select remarks, score_sum, histogram[1],
+// ..., histogram[10] from dish_stats`, all zero if the dish has no
+// row.
+dish_stats to_dish_stats(const pqxx::result& result);
+
+// `[{low, high, count, percent}, ...]` for the dish page.
+boost::json::array histogram_to_json(const dish_stats& stats);
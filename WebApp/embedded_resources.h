@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstddef>
+#include <ctime>
+
+// a file packed into the binary by resource_packer, see
+// `WEBAPP_EMBED_RESOURCES` in CMakeLists.txt.
+struct embedded_resource {
+	const char* name;
+	const unsigned char* data;
+	std::size_t size;
+	// gzip encoded data, null if the file is not compressible.
+	const unsigned char* gzip;
+	std::size_t gzip_size;
+	const char* etag;
+	std::time_t mtime;
+};
+
+// the html templates, by file name.
+const embedded_resource* embedded_templates(std::size_t& count);
+
+// the files under the static root, by path relative to it.
+// `thumbs/` is not packed: the image variants are generated from
+// the embedded originals into the static root on first request.
+const embedded_resource* embedded_statics(std::size_t& count);
@@ -1,8 +1,22 @@
 #include "handlers.h"
 
 #include <vector>
+#include <cmath>
+#include <sstream>
 
 #include "rendering.h"
+#include "static_files.h"
+#include "image_variants.h"
+#include "metrics.h"
+#include "statements.h"
+#include "pagination.h"
+#include "dish_stats.h"
+#include "read_pool.h"
+#include "query_batch.h"
+#include "menu_io.h"
+#include "compression.h"
+#include "reference_data.h"
+#include "search_index.h"
 
 // register an orm mapping (to convert the db query results into
 // json objects).
@@ -63,10 +77,6 @@ bserv::db_relation_to_object orm_remark{
 	bserv::make_db_field<int>("D_")
 };
 
-bserv::db_relation_to_object orm_score{
-	bserv::make_db_field<int>("score"),
-};
-
 bserv::db_relation_to_object orm_window_management{
 	bserv::make_db_field<int>("W_"),
 	bserv::make_db_field<std::string>("Wname"),
@@ -95,6 +105,19 @@ bserv::db_relation_to_object orm_tag_management{
 	bserv::make_db_field<std::string>("Tname")
 };
 
+// hot queries of the menu pages, prepared on every connection.
+const std::string stmt_dish = register_statement("dish",
+	"select * from dish where dish.D_ = ?");
+const std::string stmt_dish_remarks = register_statement("dish_remarks",
+	"select R_, Rcontext, Rmark, auth_user.id, username, D_ from remark, auth_user"
+	" where remark.D_ = ? and remark.id = auth_user.id");
+const std::string stmt_dish_tags = register_statement("dish_tags",
+	"select * from tag, tag_belong where tag_belong.D_ = ? and tag.T_ = tag_belong.T_");
+const std::string stmt_dish_stats = register_statement("dish_stats",
+	"select remarks, score_sum, histogram[1], histogram[2], histogram[3], histogram[4], "
+	"histogram[5], histogram[6], histogram[7], histogram[8], histogram[9], histogram[10] "
+	"from dish_stats where D_ = ?");
+
 std::optional<boost::json::object> get_user(
 	bserv::db_transaction& tx,
 	const boost::json::string& username) {
@@ -240,6 +263,7 @@ boost::json::object add_canteen_register(
 		C_, Cname, Cpicture);
 	lginfo << r.query();
 	tx.commit(); // you must manually commit changes
+	reload_reference_data(conn);
 	return {
 		{"success", true},
 		{"message", "user registered"}
@@ -286,6 +310,7 @@ boost::json::object add_window_register(
 		bserv::db_name("win"), Wname, Wlocation, Cname);
 	lginfo << r.query();
 	tx.commit(); // you must manually commit changes
+	reload_reference_data(conn);
 	return {
 		{"success", true},
 		{"message", "user registered"}
@@ -332,9 +357,11 @@ boost::json::object add_dish_register(
 		"(Dname, Dprice, is_sell, Dpicture, W_) values "
 		"(?, ?, TRUE, ?, "
 		"(select win.W_ from win, canteen where win.C_ = canteen.C_ and win.Wname = ? and canteen.Cname = ? )  "
-		");", Dname, Dprice, Dpicture, Wname, Cname );
+		") returning D_;", Dname, Dprice, Dpicture, Wname, Cname );
 	lginfo << r.query();
+	int D_ = (*r.begin())[0].as<int>();
 	tx.commit(); // you must manually commit changes
+	reload_dish(conn, D_);
 	return {
 		{"success", true},
 		{"message", "user registered"}
@@ -379,6 +406,7 @@ boost::json::object add_tag_register(
 	std::cout << "2" << std::endl;
 	lginfo << r.query();
 	tx.commit(); // you must manually commit changes
+	reload_reference_data(conn);
 	std::cout << "3" << std::endl;
 	return {
 		{"success", true},
@@ -423,6 +451,7 @@ boost::json::object add_dish_tag_register(
 		"((select T_ from tag where tag.Tname = ?), ?);", Tname, D_);
 	lginfo << r.query();
 	tx.commit(); // you must manually commit changes
+	reload_reference_data(conn);
 	return {
 		{"success", true},
 		{"message", "user registered"}
@@ -455,6 +484,7 @@ boost::json::object delete_canteen_from_database(
 	bserv::db_result r = tx.exec("delete from canteen where C_ = ?", C_);
 	lginfo << r.query();
 	tx.commit(); // you must manually commit changes
+	reload_reference_data(conn);
 	return {
 		{"success", true},
 		{"message", "user registered"}
@@ -487,6 +517,7 @@ boost::json::object delete_window_from_database(
 	bserv::db_result r = tx.exec("delete from win where W_ = ?", W_);
 	lginfo << r.query();
 	tx.commit(); // you must manually commit changes
+	reload_reference_data(conn);
 	return {
 		{"success", true},
 		{"message", "user registered"}
@@ -519,6 +550,7 @@ boost::json::object delete_dish_from_database(
 	bserv::db_result r = tx.exec("delete from dish where D_ = ?", D_);
 	lginfo << r.query();
 	tx.commit(); // you must manually commit changes
+	reload_dish(conn, D_);
 	return {
 		{"success", true},
 		{"message", "user registered"}
@@ -552,6 +584,7 @@ boost::json::object delete_tag_from_database(
 	bserv::db_result r = tx.exec("delete from tag where T_ = ?", T_);
 	lginfo << r.query();
 	tx.commit(); // you must manually commit changes
+	reload_reference_data(conn);
 	return {
 		{"success", true},
 		{"message", "user registered"}
@@ -585,6 +618,7 @@ boost::json::object delete_dish_tag_from_database(
 	bserv::db_result r = tx.exec("delete from tag_belong where T_ = ? and D_ = ?", T_, D_);
 	lginfo << r.query();
 	tx.commit(); // you must manually commit changes
+	reload_reference_data(conn);
 	return {
 		{"success", true},
 		{"message", "user registered"}
@@ -614,9 +648,17 @@ boost::json::object delete_remark_from_database(
 	//}
 	int R_ = atof(params["R_"].as_string().c_str());
 	bserv::db_transaction tx{ conn };
-	bserv::db_result r = tx.exec("delete from remark where R_ = ?", R_);
+	bserv::db_result r = tx.exec("delete from remark where R_ = ? returning D_, Rmark, Rcontext", R_);
 	lginfo << r.query();
+	if (r.size() != 0 && !(*r.begin())[1].is_null())
+		remove_dish_score(tx, (*r.begin())[0].as<int>(), (*r.begin())[1].as<int>());
 	tx.commit(); // you must manually commit changes
+	if (r.size() != 0) {
+		auto row = *r.begin();
+		unindex_remark(row[0].as<int>(),
+			row[2].is_null() ? "" : row[2].as<std::string>(),
+			row[1].is_null() ? 0 : row[1].as<int>());
+	}
 	return {
 		{"success", true},
 		{"message", "user registered"}
@@ -709,6 +751,7 @@ boost::json::object update_canteen_from_database(
 	bserv::db_result r = tx.exec("update canteen set Cname = ?, Cpicture = ?  where C_=?;", Cname, Cpicture, C_);
 	lginfo << r.query();
 	tx.commit(); // you must manually commit changes
+	reload_reference_data(conn);
 	return {
 		{"success", true},
 		{"message", "user registered"}
@@ -752,6 +795,7 @@ boost::json::object update_window_from_database(
 								Wname, Wlocation, Cname, W_);
 	lginfo << r.query();
 	tx.commit(); // you must manually commit changes
+	reload_reference_data(conn);
 	return {
 		{"success", true},
 		{"message", "user registered"}
@@ -807,6 +851,7 @@ boost::json::object update_dish_from_database(
 						Dname, Dprice, is_sell, Dpicture, Cname, Wname, D_);
 	lginfo << r.query();
 	tx.commit(); // you must manually commit changes
+	reload_dish(conn, D_);
 	return {
 		{"success", true},
 		{"message", "user registered"}
@@ -848,6 +893,7 @@ boost::json::object update_tag_from_database(
 	bserv::db_result r = tx.exec("update tag set Tname = ? where T_ = ?", Tname, T_);
 	lginfo << r.query();
 	tx.commit(); // you must manually commit changes
+	reload_reference_data(conn);
 	return {
 		{"success", true},
 		{"message", "user registered"}
@@ -1010,15 +1056,223 @@ std::nullopt_t ws_echo(
 
 
 std::nullopt_t serve_static_files(
+	bserv::request_type& request,
 	bserv::response_type& response,
 	const std::string& path) {
-	return serve(response, path);
+	return serve(request, response, path);
+}
+
+std::nullopt_t serve_image(
+	bserv::request_type& request,
+	bserv::response_type& response,
+	const std::string& width,
+	const std::string& path) {
+	return serve_image_variant(request, response, width, path);
+}
+
+// the counters say how busy the server is and how large its tables
+// are, administrators only.
+boost::json::object view_metrics(std::shared_ptr<bserv::session_type> session_ptr) {
+	if (!session_ptr->contains("superuser"))
+		throw bserv::url_not_found_exception{};
+	// the planning of the prepared statements is counted by postgres
+	try {
+		auto conn = read_connection();
+		if (!sample_statement_plans(conn->get()))
+			lgdebug << "pg_stat_statements is not installed, no sql.*.plans" << std::endl;
+	}
+	catch (const std::exception& e) {
+		lgwarning << "statement plans not sampled: " << e.what() << std::endl;
+	}
+	return metrics_snapshot();
+}
+
+// up to 10 dishes whose name starts with `q`, in name order, for
+// search as you type.
+boost::json::object suggest_dishes(boost::json::object&& params) {
+	auto data = reference_snapshot();
+	boost::json::array dishes;
+	if (params["q"].is_string()) {
+		for (std::uint32_t i : first_dishes_by_prefix(*data, params["q"].as_string().c_str(), 10)) {
+			dishes.push_back({
+				{"D_", data->dishes[i]->id},
+				{"Dname", data->dishes[i]->name},
+				{"C_", data->dishes[i]->canteen},
+				{"W_", data->dishes[i]->window}
+			});
+		}
+	}
+	return {
+		{"success", true},
+		{"dishes", dishes}
+	};
+}
+
+// the best `limit` dishes for `query` that are on the menu, with
+// their score.
+boost::json::array find_search_results(
+	const reference_data& data,
+	const std::string& query,
+	std::size_t limit) {
+	boost::json::array results;
+	for (const search_hit& hit : search_dishes(query, limit)) {
+		auto it = data.positions.find(hit.dish);
+		if (it == data.positions.end())
+			continue;
+		const menu_dish& dish = *data.dishes[it->second];
+		boost::json::object result = dish.json;
+		result["C_"] = dish.canteen;
+		result["score"] = hit.score;
+		results.push_back(std::move(result));
+	}
+	return results;
+}
+
+// dishes matching `q` in their name or remarks, best first.
+boost::json::object search_api(boost::json::object&& params) {
+	auto data = reference_snapshot();
+	std::string query;
+	if (params["q"].is_string())
+		query = params["q"].as_string().c_str();
+	return {
+		{"success", true},
+		{"dishes", find_search_results(*data, query, 50)}
+	};
+}
+
+// the body is a menu file, csv or (with a json content type) json.
+// requests are limited in size, larger menus go through menu_tool.
+boost::json::object import_menu(
+	bserv::request_type& request,
+	std::shared_ptr<bserv::db_connection> conn,
+	std::shared_ptr<bserv::session_type> session_ptr) {
+	if (request.method() != boost::beast::http::verb::post) {
+		throw bserv::url_not_found_exception{};
+	}
+	if (!session_ptr->contains("superuser")) {
+		return {
+			{"success", false},
+			{"message", "only administrators can import menus"}
+		};
+	}
+	menu_import_result result;
+	try {
+		if (request[bserv::http::field::content_type].find("json") != boost::beast::string_view::npos) {
+			result = import_menu_json(conn->get(), boost::json::parse(request.body()).as_array());
+		}
+		else {
+			std::istringstream in{ request.body() };
+			result = import_menu_csv(conn->get(), in);
+		}
+	}
+	catch (const std::exception& e) {
+		lgwarning << "menu import failed: " << e.what() << std::endl;
+		return {
+			{"success", false},
+			{"message", e.what()}
+		};
+	}
+	reload_reference_data(conn);
+	lginfo << "menu imported: " << result.rows << " rows" << std::endl;
+	return {
+		{"success", true},
+		{"message", "menu imported"},
+		{"imported", to_json(result)}
+	};
+}
+
+// the csv is written straight into the response body (a string
+// body), so it is held whole once: the endpoint is bounded by the
+// menu size. menu_tool export streams it to a file instead.
+std::nullopt_t export_menu(
+	std::shared_ptr<bserv::session_type> session_ptr,
+	bserv::request_type& request,
+	bserv::response_type& response) {
+	if (!session_ptr->contains("superuser")) {
+		throw bserv::url_not_found_exception{};
+	}
+	auto conn = read_connection();
+	response.body().clear();
+	body_streambuf buffer{ response.body() };
+	std::ostream out{ &buffer };
+	export_menu_csv(conn->get(), out);
+	response.set(bserv::http::field::content_type, "text/csv; charset=utf-8");
+	response.set(bserv::http::field::content_disposition, "attachment; filename=\"menu.csv\"");
+	response.prepare_payload();
+	compress_response(request, response);
+	return std::nullopt;
+}
+
+// a row of `dish.*, win.C_`.
+menu_dish menu_dish_of(const pqxx::row& row) {
+	menu_dish dish;
+	dish.id = row[0].as<int>();
+	dish.name = row[1].as<std::string>();
+	dish.window = row[5].as<int>();
+	dish.canteen = row[6].as<int>();
+	dish.json = orm_dish.convert_row(row);
+	return dish;
+}
+
+reference_data load_reference_data(const std::shared_ptr<bserv::db_connection>& conn) {
+	lgdebug << "load reference data" << std::endl;
+	db_read_transaction tx{ conn };
+	reference_data data;
+	bserv::db_result db_res = tx.exec("select * from canteen order by C_;");
+	lginfo << db_res.query();
+	for (auto& canteen : orm_canteen.convert_to_vector(db_res))
+		data.canteens.push_back(std::move(canteen));
+	db_res = tx.exec("select * from win order by W_;");
+	lginfo << db_res.query();
+	for (auto& window : orm_win.convert_to_vector(db_res)) {
+		int C_ = (int)window["C_"].as_int64();
+		data.windows[C_].push_back(std::move(window));
+	}
+	db_res = tx.exec("select * from tag order by T_;");
+	lginfo << db_res.query();
+	boost::json::array tags;
+	for (auto& tag : orm_tag.convert_to_vector(db_res))
+		tags.push_back(std::move(tag));
+	// the dishes with the canteen of their window after the dish columns
+	db_res = tx.exec("select dish.*, win.C_ from dish, win where dish.W_ = win.W_ order by dish.D_;");
+	lginfo << db_res.query();
+	for (const auto& row : db_res) {
+		auto dish = std::make_shared<menu_dish>(menu_dish_of(row));
+		data.positions[dish->id] = (std::uint32_t)data.dishes.size();
+		data.dishes.push_back(std::move(dish));
+	}
+	db_res = tx.exec("select T_, D_ from tag_belong;");
+	lginfo << db_res.query();
+	for (const auto& row : db_res) {
+		auto it = data.positions.find(row[1].as<int>());
+		if (it != data.positions.end())
+			data.tag_dishes.try_emplace(row[0].as<int>(), data.dishes.size()).first->second.set(it->second);
+	}
+	// the tags of each canteen and window, from the bitmaps
+	index_menu(data, std::move(tags));
+	return data;
+}
+
+std::optional<dish_update> load_menu_dish(const std::shared_ptr<bserv::db_connection>& conn, int id) {
+	db_read_transaction tx{ conn };
+	bserv::db_result db_res = tx.exec("select dish.*, win.C_ from dish, win where dish.W_ = win.W_ and dish.D_ = ?;", id);
+	lginfo << db_res.query();
+	if (db_res.size() == 0)
+		return std::nullopt;
+	dish_update update;
+	update.dish = menu_dish_of(*db_res.begin());
+	db_res = tx.exec("select T_ from tag_belong where D_ = ?;", id);
+	lginfo << db_res.query();
+	for (const auto& row : db_res)
+		update.tags.push_back(row[0].as<int>());
+	return update;
 }
 
 //ҳindex
 std::nullopt_t index(
 	const std::string& template_path,
 	std::shared_ptr<bserv::session_type> session_ptr,
+	bserv::request_type& request,
 	bserv::response_type& response,
 	boost::json::object& context) {
 	bserv::session_type& session = *session_ptr;
@@ -1028,30 +1282,38 @@ std::nullopt_t index(
 	if (session.contains("superuser")) {
 		context["superuser"] = session["superuser"];
 	}
-	return render(response, template_path, context);
+	return render(request, response, template_path, context);
 }
 
 std::nullopt_t index_page(
-	std::shared_ptr<bserv::db_connection> conn,
 	std::shared_ptr<bserv::session_type> session_ptr,
+	bserv::request_type& request,
 	bserv::response_type& response) {
+	auto data = reference_snapshot();
 	boost::json::object context;
+	context["canteens"] = data->canteens;
+	return index("index.html", session_ptr, request, response, context);
+}
 
-	lgdebug << "view canteen: " << std::endl;
-	bserv::db_transaction tx{ conn };
-	bserv::db_result db_res = tx.exec("select count(*) from canteen;");
-	lginfo << db_res.query();
-	std::size_t total_canteens = (*db_res.begin())[0].as<std::size_t>();
-	lgdebug << "total canteens: " << total_canteens << std::endl;
-	db_res = tx.exec("select * from canteen;");
-	lginfo << db_res.query();
-	auto canteens = orm_canteen.convert_to_vector(db_res);
-	boost::json::array json_canteens;
-	for (auto& canteen : canteens) {
-		json_canteens.push_back(canteen);
-	}
-	context["canteens"] = json_canteens;
-	return index("index.html", session_ptr, response, context);
+std::nullopt_t search_page(
+	boost::json::object&& params,
+	std::shared_ptr<bserv::session_type> session_ptr,
+	bserv::request_type& request,
+	bserv::response_type& response) {
+	auto data = reference_snapshot();
+	boost::json::object context;
+	std::string query;
+	if (params["q"].is_string())
+		query = params["q"].as_string().c_str();
+	// the template prints these as is
+	context["query"] = escape_html(query);
+	boost::json::array dishes = find_search_results(*data, query, 50);
+	for (auto& dish : dishes)
+		for (auto& field : dish.as_object())
+			if (field.value().is_string())
+				field.value() = escape_html(field.value().as_string().c_str());
+	context["dishes"] = std::move(dishes);
+	return index("search.html", session_ptr, request, response, context);
 }
 
 std::nullopt_t form_login(
@@ -1063,559 +1325,181 @@ std::nullopt_t form_login(
 	lgdebug << params << std::endl;
 	auto context = user_login(request, std::move(params), conn, session_ptr);
 
-	lgdebug << "view canteen: " << std::endl;
-	bserv::db_transaction tx{ conn };
-	bserv::db_result db_res = tx.exec("select count(*) from canteen;");
-	lginfo << db_res.query();
-	std::size_t total_canteens = (*db_res.begin())[0].as<std::size_t>();
-	lgdebug << "total canteens: " << total_canteens << std::endl;
-	db_res = tx.exec("select * from canteen;");
-	lginfo << db_res.query();
-	auto canteens = orm_canteen.convert_to_vector(db_res);
-	boost::json::array json_canteens;
-	for (auto& canteen : canteens) {
-		json_canteens.push_back(canteen);
-	}
-	context["canteens"] = json_canteens;
+	context["canteens"] = get_reference_data(conn)->canteens;
 	lginfo << "login: " << context << std::endl;
-	return index("index.html", session_ptr, response, context);
+	return index("index.html", session_ptr, request, response, context);
 }
 
 std::nullopt_t form_logout(
 	std::shared_ptr<bserv::db_connection> conn,
 	std::shared_ptr<bserv::session_type> session_ptr,
+	bserv::request_type& request,
 	bserv::response_type& response) {
 	auto context = user_logout(session_ptr);
-	lgdebug << "view canteen: " << std::endl;
-	bserv::db_transaction tx{ conn };
-	bserv::db_result db_res = tx.exec("select count(*) from canteen;");
-	lginfo << db_res.query();
-	std::size_t total_canteens = (*db_res.begin())[0].as<std::size_t>();
-	lgdebug << "total canteens: " << total_canteens << std::endl;
-	db_res = tx.exec("select * from canteen;");
-	lginfo << db_res.query();
-	auto canteens = orm_canteen.convert_to_vector(db_res);
-	boost::json::array json_canteens;
-	for (auto& canteen : canteens) {
-		json_canteens.push_back(canteen);
-	}
-	context["canteens"] = json_canteens;
+	context["canteens"] = get_reference_data(conn)->canteens;
 
 	lginfo << "logout: " << context << std::endl;
-	return index("index.html", session_ptr, response, context);
+	return index("index.html", session_ptr, request, response, context);
 }
 
 std::nullopt_t redirect_to_users(
 	std::shared_ptr<bserv::db_connection> conn,
 	std::shared_ptr<bserv::session_type> session_ptr,
+	bserv::request_type& request,
 	bserv::response_type& response,
 	int page_id,
 	boost::json::object&& context) {
 	lgdebug << "view users: " << page_id << std::endl;
-	bserv::db_transaction tx{ conn };
-	bserv::db_result db_res = tx.exec("select count(*) from auth_user;");
-	lginfo << db_res.query();
-	std::size_t total_users = (*db_res.begin())[0].as<std::size_t>();
-	lgdebug << "total users: " << total_users << std::endl;
-	int total_pages = (int)total_users / 10;
-	if (total_users % 10 != 0) ++total_pages;
-	lgdebug << "total pages: " << total_pages << std::endl;
-	db_res = tx.exec("select * from auth_user limit 10 offset ?;", (page_id - 1) * 10);
-	lginfo << db_res.query();
-	auto users = orm_user.convert_to_vector(db_res);
-	boost::json::array json_users;
-	for (auto& user : users) {
-		json_users.push_back(user);
-	}
-	boost::json::object pagination;
-	if (total_pages != 0) {
-		pagination["total"] = total_pages;
-		if (page_id > 1) {
-			pagination["previous"] = page_id - 1;
-		}
-		if (page_id < total_pages) {
-			pagination["next"] = page_id + 1;
-		}
-		int lower = page_id - 3;
-		int upper = page_id + 3;
-		if (page_id - 3 > 2) {
-			pagination["left_ellipsis"] = true;
-		}
-		else {
-			lower = 1;
-		}
-		if (page_id + 3 < total_pages - 1) {
-			pagination["right_ellipsis"] = true;
-		}
-		else {
-			upper = total_pages;
-		}
-		pagination["current"] = page_id;
-		boost::json::array pages_left;
-		for (int i = lower; i < page_id; ++i) {
-			pages_left.push_back(i);
-		}
-		pagination["pages_left"] = pages_left;
-		boost::json::array pages_right;
-		for (int i = page_id + 1; i <= upper; ++i) {
-			pages_right.push_back(i);
-		}
-		pagination["pages_right"] = pages_right;
-		context["pagination"] = pagination;
-	}
-	context["users"] = json_users;
-	return index("users.html", session_ptr, response, context);
+	db_read_transaction tx{ conn };
+	page_result users = paginate(tx, orm_user, request,
+		"select * from auth_user",
+		"id", page_id);
+	set_pagination(context, page_id, users);
+	context["users"] = users.rows;
+	return index("users.html", session_ptr, request, response, context);
 }
 
 std::nullopt_t redirect_to_users_login(
 	std::shared_ptr<bserv::db_connection> conn,
 	std::shared_ptr<bserv::session_type> session_ptr,
+	bserv::request_type& request,
 	bserv::response_type& response,
 	int page_id,
 	boost::json::object&& context) {
 	lgdebug << "view users: " << page_id << std::endl;
-	bserv::db_transaction tx{ conn };
-	bserv::db_result db_res = tx.exec("select count(*) from auth_user;");
-	lginfo << db_res.query();
-	std::size_t total_users = (*db_res.begin())[0].as<std::size_t>();
-	lgdebug << "total users: " << total_users << std::endl;
-	int total_pages = (int)total_users / 10;
-	if (total_users % 10 != 0) ++total_pages;
-	lgdebug << "total pages: " << total_pages << std::endl;
-	db_res = tx.exec("select * from auth_user limit 10 offset ?;", (page_id - 1) * 10);
-	lginfo << db_res.query();
-	auto users = orm_user.convert_to_vector(db_res);
-	boost::json::array json_users;
-	for (auto& user : users) {
-		json_users.push_back(user);
-	}
-	boost::json::object pagination;
-	if (total_pages != 0) {
-		pagination["total"] = total_pages;
-		if (page_id > 1) {
-			pagination["previous"] = page_id - 1;
-		}
-		if (page_id < total_pages) {
-			pagination["next"] = page_id + 1;
-		}
-		int lower = page_id - 3;
-		int upper = page_id + 3;
-		if (page_id - 3 > 2) {
-			pagination["left_ellipsis"] = true;
-		}
-		else {
-			lower = 1;
-		}
-		if (page_id + 3 < total_pages - 1) {
-			pagination["right_ellipsis"] = true;
-		}
-		else {
-			upper = total_pages;
-		}
-		pagination["current"] = page_id;
-		boost::json::array pages_left;
-		for (int i = lower; i < page_id; ++i) {
-			pages_left.push_back(i);
-		}
-		pagination["pages_left"] = pages_left;
-		boost::json::array pages_right;
-		for (int i = page_id + 1; i <= upper; ++i) {
-			pages_right.push_back(i);
-		}
-		pagination["pages_right"] = pages_right;
-		context["pagination"] = pagination;
-	}
-	context["users"] = json_users;
+	db_read_transaction tx{ conn };
+	page_result users = paginate(tx, orm_user, request,
+		"select * from auth_user",
+		"id", page_id);
+	set_pagination(context, page_id, users);
+	context["users"] = users.rows;
 
-	lgdebug << "view canteen: " << std::endl;
-	db_res = tx.exec("select count(*) from canteen;");
-	lginfo << db_res.query();
-	std::size_t total_canteens = (*db_res.begin())[0].as<std::size_t>();
-	lgdebug << "total canteens: " << total_canteens << std::endl;
-	db_res = tx.exec("select * from canteen;");
-	lginfo << db_res.query();
-	auto canteens = orm_canteen.convert_to_vector(db_res);
-	boost::json::array json_canteens;
-	for (auto& canteen : canteens) {
-		json_canteens.push_back(canteen);
-	}
-	context["canteens"] = json_canteens;
-	return index("index.html", session_ptr, response, context);
+	context["canteens"] = get_reference_data(conn)->canteens;
+	return index("index.html", session_ptr, request, response, context);
 }
 
 std::nullopt_t redirect_to_canteen(
 	std::shared_ptr<bserv::db_connection> conn,
 	std::shared_ptr<bserv::session_type> session_ptr,
+	bserv::request_type& request,
 	bserv::response_type& response,
 	int page_id,
 	boost::json::object&& context) {
 	lgdebug << "view canteens: " << page_id << std::endl;
-	bserv::db_transaction tx{ conn };
-	bserv::db_result db_res = tx.exec("select count(*) from canteen;");
-	lginfo << db_res.query();
-	std::size_t total_canteens = (*db_res.begin())[0].as<std::size_t>();
-	lgdebug << "total canteens: " << total_canteens << std::endl;
-	int total_pages = (int)total_canteens / 10;
-	if (total_canteens % 10 != 0) ++total_pages;
-	lgdebug << "total pages: " << total_pages << std::endl;
-	db_res = tx.exec("select * from canteen limit 10 offset ?;", (page_id - 1) * 10);
-	lginfo << db_res.query();
-	auto canteens = orm_canteen.convert_to_vector(db_res);
-	boost::json::array json_canteens;
-	for (auto& canteen : canteens) {
-		json_canteens.push_back(canteen);
-	}
-	boost::json::object pagination;
-	if (total_pages != 0) {
-		pagination["total"] = total_pages;
-		if (page_id > 1) {
-			pagination["previous"] = page_id - 1;
-		}
-		if (page_id < total_pages) {
-			pagination["next"] = page_id + 1;
-		}
-		int lower = page_id - 3;
-		int upper = page_id + 3;
-		if (page_id - 3 > 2) {
-			pagination["left_ellipsis"] = true;
-		}
-		else {
-			lower = 1;
-		}
-		if (page_id + 3 < total_pages - 1) {
-			pagination["right_ellipsis"] = true;
-		}
-		else {
-			upper = total_pages;
-		}
-		pagination["current"] = page_id;
-		boost::json::array pages_left;
-		for (int i = lower; i < page_id; ++i) {
-			pages_left.push_back(i);
-		}
-		pagination["pages_left"] = pages_left;
-		boost::json::array pages_right;
-		for (int i = page_id + 1; i <= upper; ++i) {
-			pages_right.push_back(i);
-		}
-		pagination["pages_right"] = pages_right;
-		context["pagination"] = pagination;
-	}
-	context["canteens"] = json_canteens;
-	return index("canteen_management.html", session_ptr, response, context);
+	db_read_transaction tx{ conn };
+	page_result canteens = paginate(tx, orm_canteen, request,
+		"select * from canteen",
+		"C_", page_id);
+	set_pagination(context, page_id, canteens);
+	context["canteens"] = canteens.rows;
+	return index("canteen_management.html", session_ptr, request, response, context);
 }
 
 std::nullopt_t redirect_to_window(
 	std::shared_ptr<bserv::db_connection> conn,
 	std::shared_ptr<bserv::session_type> session_ptr,
+	bserv::request_type& request,
 	bserv::response_type& response,
 	int page_id,
 	boost::json::object&& context) {
 	lgdebug << "view windows: " << page_id << std::endl;
-	bserv::db_transaction tx{ conn };
-	bserv::db_result db_res = tx.exec("select count(*) from win, canteen where win.C_=canteen.C_;");
-	lginfo << db_res.query();
-	std::size_t total_windows = (*db_res.begin())[0].as<std::size_t>();
-	lgdebug << "total windows: " << total_windows << std::endl;
-	int total_pages = (int)total_windows / 10;
-	if (total_windows % 10 != 0) ++total_pages;
-	lgdebug << "total pages: " << total_pages << std::endl;
-	db_res = tx.exec("select W_, Wname, Wlocation, win.C_, Cname, Cpicture from win, canteen where win.C_=canteen.C_ limit 10 offset ?;", (page_id - 1) * 10);
-	lginfo << db_res.query();
-	auto windows = orm_window_management.convert_to_vector(db_res);
-	boost::json::array json_windows;
-	for (auto& window : windows) {
-		json_windows.push_back(window);
-	}
-	boost::json::object pagination;
-	if (total_pages != 0) {
-		pagination["total"] = total_pages;
-		if (page_id > 1) {
-			pagination["previous"] = page_id - 1;
-		}
-		if (page_id < total_pages) {
-			pagination["next"] = page_id + 1;
-		}
-		int lower = page_id - 3;
-		int upper = page_id + 3;
-		if (page_id - 3 > 2) {
-			pagination["left_ellipsis"] = true;
-		}
-		else {
-			lower = 1;
-		}
-		if (page_id + 3 < total_pages - 1) {
-			pagination["right_ellipsis"] = true;
-		}
-		else {
-			upper = total_pages;
-		}
-		pagination["current"] = page_id;
-		boost::json::array pages_left;
-		for (int i = lower; i < page_id; ++i) {
-			pages_left.push_back(i);
-		}
-		pagination["pages_left"] = pages_left;
-		boost::json::array pages_right;
-		for (int i = page_id + 1; i <= upper; ++i) {
-			pages_right.push_back(i);
-		}
-		pagination["pages_right"] = pages_right;
-		context["pagination"] = pagination;
-	}
-	context["windows"] = json_windows;
-	return index("window_management.html", session_ptr, response, context);
+	db_read_transaction tx{ conn };
+	page_result windows = paginate(tx, orm_window_management, request,
+		"select W_, Wname, Wlocation, win.C_, Cname, Cpicture from win, canteen where win.C_=canteen.C_",
+		"W_", page_id);
+	set_pagination(context, page_id, windows);
+	context["windows"] = windows.rows;
+	return index("window_management.html", session_ptr, request, response, context);
 }
 
 std::nullopt_t redirect_to_dish(
 	std::shared_ptr<bserv::db_connection> conn,
 	std::shared_ptr<bserv::session_type> session_ptr,
+	bserv::request_type& request,
 	bserv::response_type& response,
 	int page_id,
 	boost::json::object&& context) {
 	lgdebug << "view dishes: " << page_id << std::endl;
-	bserv::db_transaction tx{ conn };
-	bserv::db_result db_res = tx.exec("select count(*) from dish, win, canteen where dish.W_=win.W_ and win.C_=canteen.C_ ;");
-	lginfo << db_res.query();
-	std::size_t total_dishes = (*db_res.begin())[0].as<std::size_t>();
-	lgdebug << "total dishes: " << total_dishes << std::endl;
-	int total_pages = (int)total_dishes / 10;
-	if (total_dishes % 10 != 0) ++total_pages;
-	lgdebug << "total pages: " << total_pages << std::endl;
-	db_res = tx.exec("select D_, Dname,  Dprice, is_sell, Dpicture, win.W_, Wname, Wlocation, canteen.C_, Cname, Cpicture from dish, win, canteen where dish.W_=win.W_ and win.C_=canteen.C_ limit 10 offset ?;", (page_id - 1) * 10);
-	lginfo << db_res.query();
-	auto dishes = orm_dish_management.convert_to_vector(db_res);
-	boost::json::array json_dishes;
-	for (auto& dish : dishes) {
-		json_dishes.push_back(dish);
-	}
-	boost::json::object pagination;
-	if (total_pages != 0) {
-		pagination["total"] = total_pages;
-		if (page_id > 1) {
-			pagination["previous"] = page_id - 1;
-		}
-		if (page_id < total_pages) {
-			pagination["next"] = page_id + 1;
-		}
-		int lower = page_id - 3;
-		int upper = page_id + 3;
-		if (page_id - 3 > 2) {
-			pagination["left_ellipsis"] = true;
-		}
-		else {
-			lower = 1;
-		}
-		if (page_id + 3 < total_pages - 1) {
-			pagination["right_ellipsis"] = true;
-		}
-		else {
-			upper = total_pages;
-		}
-		pagination["current"] = page_id;
-		boost::json::array pages_left;
-		for (int i = lower; i < page_id; ++i) {
-			pages_left.push_back(i);
-		}
-		pagination["pages_left"] = pages_left;
-		boost::json::array pages_right;
-		for (int i = page_id + 1; i <= upper; ++i) {
-			pages_right.push_back(i);
-		}
-		pagination["pages_right"] = pages_right;
-		context["pagination"] = pagination;
-	}
-	context["dishes"] = json_dishes;
-	return index("dish_management.html", session_ptr, response, context);
+	db_read_transaction tx{ conn };
+	page_result dishes = paginate(tx, orm_dish_management, request,
+		"select D_, Dname, Dprice, is_sell, Dpicture, win.W_, Wname, Wlocation, canteen.C_, Cname, Cpicture "
+		"from dish, win, canteen where dish.W_=win.W_ and win.C_=canteen.C_",
+		"D_", page_id);
+	set_pagination(context, page_id, dishes);
+	context["dishes"] = dishes.rows;
+	return index("dish_management.html", session_ptr, request, response, context);
 }
 
 std::nullopt_t redirect_to_dish_search(
 	std::shared_ptr<bserv::db_connection> conn,
 	std::shared_ptr<bserv::session_type> session_ptr,
+	bserv::request_type& request,
 	bserv::response_type& response,
 	int page_id,
 	boost::json::object&& context,
 	std::string Dname_search) {
 	lgdebug << "view dishes: " << page_id << std::endl;
-	bserv::db_transaction tx{ conn };
-	bserv::db_result db_res = tx.exec("select count(*) from dish, win, canteen where dish.W_=win.W_ and win.C_=canteen.C_ and Dname like ?;", Dname_search + "%");
-	lginfo << db_res.query();
-	std::size_t total_dishes = (*db_res.begin())[0].as<std::size_t>();
-	lgdebug << "total dishes: " << total_dishes << std::endl;
-	int total_pages = (int)total_dishes / 10;
-	if (total_dishes % 10 != 0) ++total_pages;
-	lgdebug << "total pages: " << total_pages << std::endl;
-	db_res = tx.exec("select D_, Dname,  Dprice, is_sell, Dpicture, win.W_, Wname, Wlocation, canteen.C_, Cname, Cpicture from dish, win, canteen where dish.W_=win.W_ and win.C_=canteen.C_ and dish.Dname like ? limit 10 offset ?;", Dname_search + "%", (page_id - 1) * 10);
-	lginfo << db_res.query();
-	auto dishes = orm_dish_management.convert_to_vector(db_res);
-	boost::json::array json_dishes;
-	for (auto& dish : dishes) {
-		json_dishes.push_back(dish);
-	}
-	boost::json::object pagination;
-	if (total_pages != 0) {
-		pagination["total"] = total_pages;
-		if (page_id > 1) {
-			pagination["previous"] = page_id - 1;
-		}
-		if (page_id < total_pages) {
-			pagination["next"] = page_id + 1;
-		}
-		int lower = page_id - 3;
-		int upper = page_id + 3;
-		if (page_id - 3 > 2) {
-			pagination["left_ellipsis"] = true;
-		}
-		else {
-			lower = 1;
-		}
-		if (page_id + 3 < total_pages - 1) {
-			pagination["right_ellipsis"] = true;
+	// the names are matched in the menu snapshot, the page is then
+	// read by D_
+	std::string D_list = "{";
+	if (!Dname_search.empty()) {
+		auto data = get_reference_data(conn);
+		for (std::uint32_t i : find_dishes_by_prefix(*data, Dname_search).positions()) {
+			if (D_list.size() > 1)
+				D_list += ',';
+			D_list += std::to_string(data->dishes[i]->id);
 		}
-		else {
-			upper = total_pages;
-		}
-		pagination["current"] = page_id;
-		boost::json::array pages_left;
-		for (int i = lower; i < page_id; ++i) {
-			pages_left.push_back(i);
-		}
-		pagination["pages_left"] = pages_left;
-		boost::json::array pages_right;
-		for (int i = page_id + 1; i <= upper; ++i) {
-			pages_right.push_back(i);
-		}
-		pagination["pages_right"] = pages_right;
-		context["pagination"] = pagination;
 	}
-	context["dishes"] = json_dishes;
-	return index("dish_management.html", session_ptr, response, context);
+	D_list += '}';
+	db_read_transaction tx{ conn };
+	page_result dishes = Dname_search.empty()
+		? paginate(tx, orm_dish_management, request,
+			"select D_, Dname, Dprice, is_sell, Dpicture, win.W_, Wname, Wlocation, canteen.C_, Cname, Cpicture "
+			"from dish, win, canteen where dish.W_=win.W_ and win.C_=canteen.C_",
+			"D_", page_id)
+		: paginate(tx, orm_dish_management, request,
+			"select D_, Dname, Dprice, is_sell, Dpicture, win.W_, Wname, Wlocation, canteen.C_, Cname, Cpicture "
+			"from dish, win, canteen where dish.W_=win.W_ and win.C_=canteen.C_ and dish.D_ = any(?::integer[])",
+			"D_", page_id, D_list);
+	set_pagination(context, page_id, dishes);
+	context["dishes"] = dishes.rows;
+	return index("dish_management.html", session_ptr, request, response, context);
 }
 
 std::nullopt_t redirect_to_tag(
 	std::shared_ptr<bserv::db_connection> conn,
 	std::shared_ptr<bserv::session_type> session_ptr,
+	bserv::request_type& request,
 	bserv::response_type& response,
 	int page_id,
 	boost::json::object&& context) {
 	lgdebug << "view tags: " << page_id << std::endl;
-	bserv::db_transaction tx{ conn };
-	bserv::db_result db_res = tx.exec("select count(*) from tag ;");
-	lginfo << db_res.query();
-	std::size_t total_tags = (*db_res.begin())[0].as<std::size_t>();
-	lgdebug << "total tags: " << total_tags << std::endl;
-	int total_pages = (int)total_tags / 10;
-	if (total_tags % 10 != 0) ++total_pages;
-	lgdebug << "total pages: " << total_pages << std::endl;
-	db_res = tx.exec("select T_, Tname from tag limit 10 offset ?;", (page_id - 1) * 10);
-	lginfo << db_res.query();
-	auto tags = orm_tag_management.convert_to_vector(db_res);
-	boost::json::array json_tags;
-	for (auto& tag : tags) {
-		json_tags.push_back(tag);
-	}
-	boost::json::object pagination;
-	if (total_pages != 0) {
-		pagination["total"] = total_pages;
-		if (page_id > 1) {
-			pagination["previous"] = page_id - 1;
-		}
-		if (page_id < total_pages) {
-			pagination["next"] = page_id + 1;
-		}
-		int lower = page_id - 3;
-		int upper = page_id + 3;
-		if (page_id - 3 > 2) {
-			pagination["left_ellipsis"] = true;
-		}
-		else {
-			lower = 1;
-		}
-		if (page_id + 3 < total_pages - 1) {
-			pagination["right_ellipsis"] = true;
-		}
-		else {
-			upper = total_pages;
-		}
-		pagination["current"] = page_id;
-		boost::json::array pages_left;
-		for (int i = lower; i < page_id; ++i) {
-			pages_left.push_back(i);
-		}
-		pagination["pages_left"] = pages_left;
-		boost::json::array pages_right;
-		for (int i = page_id + 1; i <= upper; ++i) {
-			pages_right.push_back(i);
-		}
-		pagination["pages_right"] = pages_right;
-		context["pagination"] = pagination;
-	}
-	context["tags"] = json_tags;
-	return index("tag_management.html", session_ptr, response, context);
+	db_read_transaction tx{ conn };
+	page_result tags = paginate(tx, orm_tag_management, request,
+		"select T_, Tname from tag",
+		"T_", page_id);
+	set_pagination(context, page_id, tags);
+	context["tags"] = tags.rows;
+	return index("tag_management.html", session_ptr, request, response, context);
 }
 
 std::nullopt_t redirect_to_dish_tag(
 	std::shared_ptr<bserv::db_connection> conn,
 	std::shared_ptr<bserv::session_type> session_ptr,
+	bserv::request_type& request,
 	bserv::response_type& response,
 	int page_id,
 	int dish_id,
 	boost::json::object&& context) {
 	lgdebug << "view dish_tags: " << page_id << std::endl;
-	bserv::db_transaction tx{ conn };
-	bserv::db_result db_res = tx.exec("select count(*) from tag, tag_belong where tag.T_ = tag_belong.T_ and tag_belong.D_ = ? ;", dish_id);
-	lginfo << db_res.query();
-	std::size_t total_dish_tags = (*db_res.begin())[0].as<std::size_t>();
-	lgdebug << "total dish_tags: " << total_dish_tags << std::endl;
-	int total_pages = (int)total_dish_tags / 10;
-	if (total_dish_tags % 10 != 0) ++total_pages;
-	lgdebug << "total pages: " << total_pages << std::endl;
-	db_res = tx.exec("select tag.T_, tag.Tname from tag, tag_belong where tag.T_ = tag_belong.T_ and tag_belong.D_ = ? limit 10 offset ?;", dish_id, (page_id - 1) * 10);
-	lginfo << db_res.query();
-	auto dish_tags = orm_tag_management.convert_to_vector(db_res);
-	boost::json::array json_dish_tags;
-	for (auto& dish_tag : dish_tags) {
-		json_dish_tags.push_back(dish_tag);
-	}
-	boost::json::object pagination;
-	if (total_pages != 0) {
-		pagination["total"] = total_pages;
-		if (page_id > 1) {
-			pagination["previous"] = page_id - 1;
-		}
-		if (page_id < total_pages) {
-			pagination["next"] = page_id + 1;
-		}
-		int lower = page_id - 3;
-		int upper = page_id + 3;
-		if (page_id - 3 > 2) {
-			pagination["left_ellipsis"] = true;
-		}
-		else {
-			lower = 1;
-		}
-		if (page_id + 3 < total_pages - 1) {
-			pagination["right_ellipsis"] = true;
-		}
-		else {
-			upper = total_pages;
-		}
-		pagination["current"] = page_id;
-		boost::json::array pages_left;
-		for (int i = lower; i < page_id; ++i) {
-			pages_left.push_back(i);
-		}
-		pagination["pages_left"] = pages_left;
-		boost::json::array pages_right;
-		for (int i = page_id + 1; i <= upper; ++i) {
-			pages_right.push_back(i);
-		}
-		pagination["pages_right"] = pages_right;
-		context["pagination"] = pagination;
-	}
-	context["tags"] = json_dish_tags;
-
-	db_res = tx.exec("select * from dish where D_ = ? ;", dish_id);
+	db_read_transaction tx{ conn };
+	page_result dish_tags = paginate(tx, orm_tag_management, request,
+		"select tag.T_, tag.Tname from tag, tag_belong where tag.T_ = tag_belong.T_ and tag_belong.D_ = ?",
+		"T_", page_id, dish_id);
+	set_pagination(context, page_id, dish_tags);
+	context["tags"] = dish_tags.rows;
+
+	bserv::db_result db_res = tx.exec("select * from dish where D_ = ? ;", dish_id);
 	lginfo << db_res.query();
 	auto dishes = orm_dish.convert_to_vector(db_res);
 	boost::json::array json_dishes;
@@ -1623,12 +1507,13 @@ std::nullopt_t redirect_to_dish_tag(
 		json_dishes.push_back(dish);
 	}
 	context["dishes"] = json_dishes;
-	return index("dish_tag.html", session_ptr, response, context);
+	return index("dish_tag.html", session_ptr, request, response, context);
 }
 
 std::nullopt_t redirect_to_dish(
 	std::shared_ptr<bserv::db_connection> conn,
 	std::shared_ptr<bserv::session_type> session_ptr,
+	bserv::request_type& request,
 	bserv::response_type& response,
 	boost::json::object&& context,
 	int canteen_num,
@@ -1636,270 +1521,102 @@ std::nullopt_t redirect_to_dish(
 	int tag_num,
 	int dish_num) {
 	lgdebug << "view dish_content: " << std::endl;
-	bserv::db_transaction tx{ conn };
+	pqxx::read_transaction tx{ conn->get() };
+	// the queries do not depend on each other, one round trip
+	query_batch batch{ tx, conn };
 
 	//ƷϢ
-	bserv::db_result db_res = tx.exec("select count(*) from dish where dish.D_ = ?", dish_num);
-	lginfo << db_res.query();
-	std::size_t total_dishes = (*db_res.begin())[0].as<std::size_t>();
-	lgdebug << "total dishes: " << total_dishes << std::endl;
-	db_res = tx.exec("select * from dish where dish.D_ = ?", dish_num);
-	lginfo << db_res.query();
-
-	auto dishes = orm_dish.convert_to_vector(db_res);
-	boost::json::array json_dishes;
-	for (auto& dish : dishes) {
-		json_dishes.push_back(dish);
-	}
-	context["dishes"] = json_dishes;
-
+	auto dish_query = batch.add(stmt_dish, dish_num);
 	//Ϣ
-	db_res = tx.exec("select count(*) from remark, auth_user where remark.D_ = ? and remark.id = auth_user.id", dish_num);
-	lginfo << db_res.query();
-	std::size_t total_remarks = (*db_res.begin())[0].as<std::size_t>();
-	lgdebug << "total remarks: " << total_remarks << std::endl;
-	db_res = tx.exec("select R_, Rcontext, Rmark, auth_user.id, username, D_ from remark, auth_user where remark.D_ = ? and remark.id = auth_user.id", dish_num);
-	lginfo << db_res.query();
-
-	auto remarks = orm_remark.convert_to_vector(db_res);
-	boost::json::array json_remarks;
-	for (auto& remark : remarks) {
-		json_remarks.push_back(remark);
-	}
-	context["remarks"] = json_remarks;
+	auto remarks_query = batch.add(stmt_dish_remarks, dish_num);
+	auto stats_query = batch.add(stmt_dish_stats, dish_num);
+	//Ʒǩ
+	auto tags_query = batch.add(stmt_dish_tags, dish_num);
 
+	context["dishes"] = convert_to_array(orm_dish, batch.get(dish_query));
+	context["remarks"] = convert_to_array(orm_remark, batch.get(remarks_query));
 
 	//score
-	db_res = tx.exec("select AVG(Rmark) from remark where remark.D_ = ?", dish_num);
-	lginfo << db_res.query();
-	//std::size_t total_score = (*db_res.begin())[0].as<std::size_t>();
-	//lgdebug << "total score: " << total_score << std::endl;
-	db_res = tx.exec("select floor(AVG(Rmark)) from remark where remark.D_ = ?", dish_num);
-	lginfo << db_res.query();
-	if (total_remarks != 0)
-	{
-		auto score = orm_score.convert_to_vector(db_res);
-		std::cout << "" << std::endl;
-		boost::json::array json_score;
-		for (auto& score_single : score) {
-			json_score.push_back(score_single);
-		}
-		context["score"] = json_score;
-	}
-	else
-	{
-		std::vector<boost::json::object> score;
-		std::cout << "" << std::endl;
-		boost::json::array json_score;
-		for (auto& score_single : score) {
-			json_score.push_back(score_single);
-		}
-		context["score"] = json_score;
+	dish_stats stats = to_dish_stats(batch.get(stats_query));
+	lgdebug << "total remarks: " << stats.remarks << std::endl;
+	boost::json::array json_score;
+	if (stats.remarks != 0) {
+		json_score.push_back({ { "score", (int)std::floor((double)stats.score_sum / stats.remarks) } });
+		context["histogram"] = histogram_to_json(stats);
 	}
-	
-	//Ʒǩ
-	db_res = tx.exec("select count(*) from tag, tag_belong where tag_belong.D_ = ? and tag.T_ = tag_belong.T_", dish_num);
-	lginfo << db_res.query();
-	std::size_t total_tags = (*db_res.begin())[0].as<std::size_t>();
-	lgdebug << "total tags: " << total_tags << std::endl;
-	db_res = tx.exec("select * from tag, tag_belong where tag_belong.D_ = ? and tag.T_ = tag_belong.T_", dish_num);
-	lginfo << db_res.query();
+	context["score"] = json_score;
 
-	if (total_tags != 0)
-	{
-		auto tags = orm_tag.convert_to_vector(db_res);
-		boost::json::array json_tags;
-		for (auto& tag : tags) {
-			json_tags.push_back(tag);
-		}
-		context["tags"] = json_tags;
-	}
-	else
-	{
-		std::vector<boost::json::object>  tags;
-		boost::json::array json_tags;
-		for (auto& tag : tags) {
-			json_tags.push_back(tag);
-		}
-		context["tags"] = json_tags;
-	}
+	context["tags"] = convert_to_array(orm_tag, batch.get(tags_query));
 
-	return index("dishes_content.html", session_ptr, response, context);
+	return index("dishes_content.html", session_ptr, request, response, context);
 }
 
 
 std::nullopt_t redirect_to_canteen_index(
-	std::shared_ptr<bserv::db_connection> conn,
+	const reference_data& data,
 	std::shared_ptr<bserv::session_type> session_ptr,
+	bserv::request_type& request,
 	bserv::response_type& response,
 	boost::json::object&& context,
 	int canteen_num,
 	int table_num, 
-	int tag_num,
+	const std::vector<int>& tag_nums,
+	bool match_all,
 	std::string dish_search) {
 	lgdebug << "view canteen: " << std::endl;
-	bserv::db_transaction tx{ conn };
-
+	// answered from the menu snapshot, without the database
 	//ѡòĴ
-	bserv::db_result db_res = tx.exec("SELECT count(*) from win where win.C_= ?;", canteen_num);
-	lginfo << db_res.query();
-	std::size_t total_wins = (*db_res.begin())[0].as<std::size_t>();
-	lgdebug << "total wins: " << total_wins << std::endl;
-	db_res = tx.exec("SELECT * from win where win.C_= ?;", canteen_num);
-	lginfo << db_res.query();
-	auto wins = orm_win.convert_to_vector(db_res);
-	boost::json::array json_wins;
-	for (auto& win : wins) {
-		json_wins.push_back(win);
-	}
-	context["windows"] = json_wins;
+	context["windows"] = find_or_empty(data.windows, canteen_num);
 
 	//ѡòӵеıǩ
-	db_res = tx.exec("SELECT count(*) from tag "
-					"where exists( "
-					"	select * from tag_belong, dish, win "
-					"where tag_belong.T_ = tag.T_ and tag_belong.D_ = dish.D_ and dish.W_ = win.W_ and win.C_ = ?);"
-					, canteen_num);
-	lginfo << db_res.query();
-	std::size_t total_tags = (*db_res.begin())[0].as<std::size_t>();
-	lgdebug << "total tags: " << total_tags << std::endl;
-	db_res = tx.exec( "SELECT * from tag "
-					"where exists( "
-					"	select * from tag_belong, dish, win "
-					"where tag_belong.T_ = tag.T_ and tag_belong.D_ = dish.D_ and dish.W_ = win.W_ and win.C_ = ?);"
-					, canteen_num);
-	lginfo << db_res.query();
-	auto tags = orm_tag.convert_to_vector(db_res);
-	boost::json::array json_tags;
-	for (auto& tag : tags) {
-		json_tags.push_back(tag);
-	}
-	context["tags"] = json_tags;
+	context["tags"] = find_or_empty(data.tags, canteen_num);
 
 	//ѡòضڡǩµĲƷ
-	if (table_num != 0)
-	{
-		if (tag_num != 0)
-		{
-			db_res = tx.exec("SELECT count(*) from dish "
-				"where exists( "
-				"	select * from tag_belong, win, tag "
-				"where tag_belong.T_ = tag.T_ and tag_belong.D_ = dish.D_ and dish.W_ = win.W_ and win.C_ = ? and tag.T_ = ? and win.W_ = ? and dish.Dname like ? );"
-				, canteen_num, tag_num, table_num, dish_search + "%");
-			lginfo << db_res.query();
-			std::size_t total_dishes = (*db_res.begin())[0].as<std::size_t>();
-			lgdebug << "total dishes: " << total_dishes << std::endl;
-			db_res = tx.exec("SELECT * from dish "
-				"where exists( "
-				"	select * from tag_belong, win, tag "
-				"where tag_belong.T_ = tag.T_ and tag_belong.D_ = dish.D_ and dish.W_ = win.W_ and win.C_ = ? and tag.T_ = ? and win.W_ = ? and dish.Dname like ?);"
-				, canteen_num, tag_num, table_num, dish_search + "%");
-			lginfo << db_res.query();
-		}
-		else
-		{
-			db_res = tx.exec("SELECT count(*) from dish "
-				"where exists( "
-				"	select * from win "
-				"where dish.W_ = win.W_ and win.C_ = ? and win.W_ = ? and dish.Dname like ?);"
-				, canteen_num, table_num, dish_search + "%");
-			lginfo << db_res.query();
-			std::size_t total_dishes = (*db_res.begin())[0].as<std::size_t>();
-			lgdebug << "total dishes: " << total_dishes << std::endl;
-			db_res = tx.exec("SELECT * from dish "
-				"where exists( "
-				"	select * from win "
-				"where dish.W_ = win.W_ and win.C_ = ? and win.W_ = ? and dish.Dname like ?);"
-				, canteen_num, table_num, dish_search + "%");
-			lginfo << db_res.query();
-		}
-	}
-	else
-	{
-		if (tag_num != 0)
-		{
-			db_res = tx.exec("SELECT count(*) from dish "
-				"where exists( "
-				"	select * from tag_belong, win, tag "
-				"where tag_belong.T_ = tag.T_ and tag_belong.D_ = dish.D_ and dish.W_ = win.W_ and win.C_ = ? and tag.T_ = ? and dish.Dname like ?);"
-				, canteen_num, tag_num, dish_search + "%");
-			lginfo << db_res.query();
-			std::size_t total_dishes = (*db_res.begin())[0].as<std::size_t>();
-			lgdebug << "total dishes: " << total_dishes << std::endl;
-			db_res = tx.exec("SELECT * from dish "
-				"where exists( "
-				"	select * from tag_belong, win, tag "
-				"where tag_belong.T_ = tag.T_ and tag_belong.D_ = dish.D_ and dish.W_ = win.W_ and win.C_ = ? and tag.T_ = ? and dish.Dname like ?);"
-				, canteen_num, tag_num, dish_search + "%");
-			lginfo << db_res.query();
-		}
-		else
-		{
-			db_res = tx.exec("SELECT count(*) from dish "
-				"where exists( "
-				"	select * from win "
-				"where dish.W_ = win.W_ and win.C_ = ? and dish.Dname like ?);"
-				, canteen_num, dish_search + "%");
-			lginfo << db_res.query();
-			std::size_t total_dishes = (*db_res.begin())[0].as<std::size_t>();
-			lgdebug << "total dishes: " << total_dishes << std::endl;
-			db_res = tx.exec("SELECT * from dish "
-				"where exists( "
-				"	select * from win "
-				"where dish.W_ = win.W_ and win.C_ = ? and dish.Dname like ?);"
-				, canteen_num, dish_search + "%");
-			lginfo << db_res.query();
-		}
-	}
-	
-
-	auto dishes = orm_dish.convert_to_vector(db_res);
-	boost::json::array json_dishes;
-	for (auto& dish : dishes) {
-		json_dishes.push_back(dish);
-	}
-	context["dishes"] = json_dishes;
-
+	context["dishes"] = find_menu_dishes(data, canteen_num, table_num, tag_nums, match_all, dish_search);
 
-	return index("dishes.html", session_ptr, response, context);
+	return index("dishes.html", session_ptr, request, response, context);
 }
 
 std::nullopt_t view_users(
-	std::shared_ptr<bserv::db_connection> conn,
 	std::shared_ptr<bserv::session_type> session_ptr,
+	bserv::request_type& request,
 	bserv::response_type& response,
 	const std::string& page_num) {
+	auto conn = read_connection();
 	int page_id = std::stoi(page_num);
 	boost::json::object context;
-	return redirect_to_users(conn, session_ptr, response, page_id, std::move(context));
+	return redirect_to_users(conn, session_ptr, request, response, page_id, std::move(context));
 }
 
 std::nullopt_t canteen_management(
-	std::shared_ptr<bserv::db_connection> conn,
 	std::shared_ptr<bserv::session_type> session_ptr,
+	bserv::request_type& request,
 	bserv::response_type& response,
 	const std::string& page_num) {
+	auto conn = read_connection();
 	int page_id = std::stoi(page_num);
 	boost::json::object context;
-	return redirect_to_canteen(conn, session_ptr, response, page_id, std::move(context));
+	return redirect_to_canteen(conn, session_ptr, request, response, page_id, std::move(context));
 }
 
 std::nullopt_t window_management(
-	std::shared_ptr<bserv::db_connection> conn,
 	std::shared_ptr<bserv::session_type> session_ptr,
+	bserv::request_type& request,
 	bserv::response_type& response,
 	const std::string& page_num) {
+	auto conn = read_connection();
 	int page_id = std::stoi(page_num);
 	boost::json::object context;
-	return redirect_to_window(conn, session_ptr, response, page_id, std::move(context));
+	return redirect_to_window(conn, session_ptr, request, response, page_id, std::move(context));
 }
 
 std::nullopt_t dish_management(
-	std::shared_ptr<bserv::db_connection> conn,
 	boost::json::object&& params,
 	std::shared_ptr<bserv::session_type> session_ptr,
+	bserv::request_type& request,
 	bserv::response_type& response,
 	const std::string& page_num) {
+	auto conn = read_connection();
 	int page_id = std::stoi(page_num);
 	boost::json::object context;
 
@@ -1910,29 +1627,31 @@ std::nullopt_t dish_management(
 	else
 		D_tmp = params_tmp["Dname_search"].as_string().c_str();
 
-	return redirect_to_dish_search(conn, session_ptr, response, page_id, std::move(context), D_tmp);
+	return redirect_to_dish_search(conn, session_ptr, request, response, page_id, std::move(context), D_tmp);
 }
 
 std::nullopt_t tag_management(
-	std::shared_ptr<bserv::db_connection> conn,
 	std::shared_ptr<bserv::session_type> session_ptr,
+	bserv::request_type& request,
 	bserv::response_type& response,
 	const std::string& page_num) {
+	auto conn = read_connection();
 	int page_id = std::stoi(page_num);
 	boost::json::object context;
-	return redirect_to_tag(conn, session_ptr, response, page_id, std::move(context));
+	return redirect_to_tag(conn, session_ptr, request, response, page_id, std::move(context));
 }
 
 std::nullopt_t dish_tag(
-	std::shared_ptr<bserv::db_connection> conn,
 	std::shared_ptr<bserv::session_type> session_ptr,
+	bserv::request_type& request,
 	bserv::response_type& response,
 	const std::string& dish_num,
 	const std::string& page_num) {
+	auto conn = read_connection();
 	int page_id = std::stoi(page_num);
 	int dish_id = std::stoi(dish_num);
 	boost::json::object context;
-	return redirect_to_dish_tag(conn, session_ptr, response, page_id, dish_id, std::move(context));
+	return redirect_to_dish_tag(conn, session_ptr, request, response, page_id, dish_id, std::move(context));
 }
 
 std::nullopt_t form_add_user(
@@ -1942,7 +1661,7 @@ std::nullopt_t form_add_user(
 	std::shared_ptr<bserv::db_connection> conn,
 	std::shared_ptr<bserv::session_type> session_ptr) {
 	boost::json::object context = user_register(request, std::move(params), conn);
-	return redirect_to_users_login(conn, session_ptr, response, 1, std::move(context));
+	return redirect_to_users_login(conn, session_ptr, request, response, 1, std::move(context));
 }
 
 std::nullopt_t form_add_canteen(
@@ -1952,7 +1671,7 @@ std::nullopt_t form_add_canteen(
 	std::shared_ptr<bserv::db_connection> conn,
 	std::shared_ptr<bserv::session_type> session_ptr) {
 	boost::json::object context = add_canteen_register(request, std::move(params), conn);
-	return redirect_to_canteen(conn, session_ptr, response, 1, std::move(context));
+	return redirect_to_canteen(conn, session_ptr, request, response, 1, std::move(context));
 }
 
 std::nullopt_t form_add_window(
@@ -1962,7 +1681,7 @@ std::nullopt_t form_add_window(
 	std::shared_ptr<bserv::db_connection> conn,
 	std::shared_ptr<bserv::session_type> session_ptr) {
 	boost::json::object context = add_window_register(request, std::move(params), conn);
-	return redirect_to_window(conn, session_ptr, response, 1, std::move(context));
+	return redirect_to_window(conn, session_ptr, request, response, 1, std::move(context));
 }
 
 std::nullopt_t form_add_dish(
@@ -1972,7 +1691,7 @@ std::nullopt_t form_add_dish(
 	std::shared_ptr<bserv::db_connection> conn,
 	std::shared_ptr<bserv::session_type> session_ptr) {
 	boost::json::object context = add_dish_register(request, std::move(params), conn);
-	return redirect_to_dish(conn, session_ptr, response, 1, std::move(context));
+	return redirect_to_dish(conn, session_ptr, request, response, 1, std::move(context));
 }
 
 std::nullopt_t form_add_tag(
@@ -1982,7 +1701,7 @@ std::nullopt_t form_add_tag(
 	std::shared_ptr<bserv::db_connection> conn,
 	std::shared_ptr<bserv::session_type> session_ptr) {
 	boost::json::object context = add_tag_register(request, std::move(params), conn);
-	return redirect_to_tag(conn, session_ptr, response, 1, std::move(context));
+	return redirect_to_tag(conn, session_ptr, request, response, 1, std::move(context));
 }
 
 std::nullopt_t form_add_dish_tag(
@@ -1994,7 +1713,7 @@ std::nullopt_t form_add_dish_tag(
 	boost::json::object context = add_dish_tag_register(request, std::move(params), conn);
 	boost::json::object&& params_tmp = std::move(params);
 	int D_tmp = atof(params_tmp["D_"].as_string().c_str());
-	return redirect_to_dish_tag(conn, session_ptr, response, 1, D_tmp, std::move(context));
+	return redirect_to_dish_tag(conn, session_ptr, request, response, 1, D_tmp, std::move(context));
 }
 
 std::nullopt_t delete_canteen(
@@ -2004,7 +1723,7 @@ std::nullopt_t delete_canteen(
 	std::shared_ptr<bserv::db_connection> conn,
 	std::shared_ptr<bserv::session_type> session_ptr) {
 	boost::json::object context = delete_canteen_from_database(request, std::move(params), conn);
-	return redirect_to_canteen(conn, session_ptr, response, 1, std::move(context));
+	return redirect_to_canteen(conn, session_ptr, request, response, 1, std::move(context));
 }
 
 std::nullopt_t delete_window(
@@ -2014,7 +1733,7 @@ std::nullopt_t delete_window(
 	std::shared_ptr<bserv::db_connection> conn,
 	std::shared_ptr<bserv::session_type> session_ptr) {
 	boost::json::object context = delete_window_from_database(request, std::move(params), conn);
-	return redirect_to_window(conn, session_ptr, response, 1, std::move(context));
+	return redirect_to_window(conn, session_ptr, request, response, 1, std::move(context));
 }
 
 std::nullopt_t delete_dish(
@@ -2025,7 +1744,7 @@ std::nullopt_t delete_dish(
 	std::shared_ptr<bserv::session_type> session_ptr) {
 	boost::json::object context = delete_dish_from_database(request, std::move(params), conn);
 	std::cout << "һ" << std::endl;
-	return redirect_to_dish(conn, session_ptr, response, 1, std::move(context));
+	return redirect_to_dish(conn, session_ptr, request, response, 1, std::move(context));
 }
 
 std::nullopt_t delete_tag(
@@ -2035,7 +1754,7 @@ std::nullopt_t delete_tag(
 	std::shared_ptr<bserv::db_connection> conn,
 	std::shared_ptr<bserv::session_type> session_ptr) {
 	boost::json::object context = delete_tag_from_database(request, std::move(params), conn);
-	return redirect_to_tag(conn, session_ptr, response, 1, std::move(context));
+	return redirect_to_tag(conn, session_ptr, request, response, 1, std::move(context));
 }
 
 std::nullopt_t delete_dish_tag(
@@ -2047,7 +1766,7 @@ std::nullopt_t delete_dish_tag(
 	boost::json::object context = delete_dish_tag_from_database(request, std::move(params), conn);
 	boost::json::object&& params_tmp = std::move(params);
 	int D_tmp = atof(params_tmp["D_"].as_string().c_str());
-	return redirect_to_dish_tag(conn, session_ptr, response, 1, D_tmp, std::move(context));
+	return redirect_to_dish_tag(conn, session_ptr, request, response, 1, D_tmp, std::move(context));
 }
 
 std::nullopt_t delete_remark(
@@ -2057,7 +1776,7 @@ std::nullopt_t delete_remark(
 	std::shared_ptr<bserv::db_connection> conn,
 	std::shared_ptr<bserv::session_type> session_ptr) {
 	boost::json::object context = delete_remark_from_database(request, std::move(params), conn);
-	return redirect_to_dish(conn, session_ptr, response, 1, std::move(context));
+	return redirect_to_dish(conn, session_ptr, request, response, 1, std::move(context));
 }
 
 std::nullopt_t delete_user(
@@ -2067,7 +1786,7 @@ std::nullopt_t delete_user(
 	std::shared_ptr<bserv::db_connection> conn,
 	std::shared_ptr<bserv::session_type> session_ptr) {
 	boost::json::object context = delete_user_from_database(request, std::move(params), conn);
-	return redirect_to_users(conn, session_ptr, response, 1, std::move(context));
+	return redirect_to_users(conn, session_ptr, request, response, 1, std::move(context));
 }
 
 std::nullopt_t update_canteen(
@@ -2077,7 +1796,7 @@ std::nullopt_t update_canteen(
 	std::shared_ptr<bserv::db_connection> conn,
 	std::shared_ptr<bserv::session_type> session_ptr) {
 	boost::json::object context = update_canteen_from_database(request, std::move(params), conn);
-	return redirect_to_canteen(conn, session_ptr, response, 1, std::move(context));
+	return redirect_to_canteen(conn, session_ptr, request, response, 1, std::move(context));
 }
 
 std::nullopt_t update_window(
@@ -2087,7 +1806,7 @@ std::nullopt_t update_window(
 	std::shared_ptr<bserv::db_connection> conn,
 	std::shared_ptr<bserv::session_type> session_ptr) {
 	boost::json::object context = update_window_from_database(request, std::move(params), conn);
-	return redirect_to_window(conn, session_ptr, response, 1, std::move(context));
+	return redirect_to_window(conn, session_ptr, request, response, 1, std::move(context));
 }
 
 std::nullopt_t update_dish(
@@ -2097,7 +1816,7 @@ std::nullopt_t update_dish(
 	std::shared_ptr<bserv::db_connection> conn,
 	std::shared_ptr<bserv::session_type> session_ptr) {
 	boost::json::object context = update_dish_from_database(request, std::move(params), conn);
-	return redirect_to_dish(conn, session_ptr, response, 1, std::move(context));
+	return redirect_to_dish(conn, session_ptr, request, response, 1, std::move(context));
 }
 
 std::nullopt_t update_tag(
@@ -2107,7 +1826,7 @@ std::nullopt_t update_tag(
 	std::shared_ptr<bserv::db_connection> conn,
 	std::shared_ptr<bserv::session_type> session_ptr) {
 	boost::json::object context = update_tag_from_database(request, std::move(params), conn);
-	return redirect_to_tag(conn, session_ptr, response, 1, std::move(context));
+	return redirect_to_tag(conn, session_ptr, request, response, 1, std::move(context));
 }
 
 std::nullopt_t form_add_remark(
@@ -2130,7 +1849,8 @@ std::nullopt_t form_add_remark(
 	
 
 	boost::json::object context = add_remark_to_database(request, std::move(params), conn, id, dish_id);
-	return dish_content(conn, session_ptr, response, canteen_num, table_num, tag_num, dish_num);
+	// read back from the primary, a replica may not have the remark yet
+	return redirect_to_dish(conn, session_ptr, request, response, std::move(context), canteen_id, table_id, tag_id, dish_id);
 }
 
 boost::json::object add_remark_to_database(
@@ -2169,7 +1889,9 @@ boost::json::object add_remark_to_database(
 		id,
 		dish_id);
 	lginfo << r.query();
+	add_dish_score(tx, dish_id, Rmark);
 	tx.commit(); // you must manually commit changes
+	index_remark(dish_id, Rcontext.c_str(), Rmark);
 	return {
 		{"success", true},
 		{"message", "user registered"}
@@ -2177,13 +1899,14 @@ boost::json::object add_remark_to_database(
 }
 
 std::nullopt_t canteen_index(
-	std::shared_ptr<bserv::db_connection> conn,
 	boost::json::object&& params,
 	std::shared_ptr<bserv::session_type> session_ptr,
+	bserv::request_type& request,
 	bserv::response_type& response,
 	const std::string& canteen_num,
 	const std::string& table_num, 
 	const std::string& tag_num) {
+	auto data = reference_snapshot();
 	int canteen_id = std::stoi(canteen_num);
 	int table_id = std::stoi(table_num);
 	int tag_id = std::stoi(tag_num);
@@ -2195,23 +1918,36 @@ std::nullopt_t canteen_index(
 		D_tmp = "";
 	else
 		D_tmp = params_tmp["Dname_search"].as_string().c_str();
-	return redirect_to_canteen_index(conn, session_ptr, response, std::move(context), canteen_id, table_id, tag_id, D_tmp);
+	// more tags as `?tags=1,2,3`, which dishes must all have, or any
+	// of them with `&match=any`
+	std::vector<int> tag_ids;
+	if (tag_id != 0)
+		tag_ids.push_back(tag_id);
+	if (params_tmp["tags"].is_string()) {
+		std::istringstream in{ std::string{ params_tmp["tags"].as_string().c_str() } };
+		for (std::string id; std::getline(in, id, ',');)
+			if (int T_ = std::atoi(id.c_str()); T_ != 0)
+				tag_ids.push_back(T_);
+	}
+	bool match_all = !(params_tmp["match"].is_string() && params_tmp["match"].as_string() == "any");
+	return redirect_to_canteen_index(*data, session_ptr, request, response, std::move(context), canteen_id, table_id, tag_ids, match_all, D_tmp);
 }
 
 std::nullopt_t dish_content(
-	std::shared_ptr<bserv::db_connection> conn,
 	std::shared_ptr<bserv::session_type> session_ptr,
+	bserv::request_type& request,
 	bserv::response_type& response,
 	const std::string& canteen_num,
 	const std::string& table_num,
 	const std::string& tag_num,
 	const std::string& dish_num) {
+	auto conn = read_connection();
 	int canteen_id = std::stoi(canteen_num);
 	int table_id = std::stoi(table_num);
 	int tag_id = std::stoi(tag_num);
 	int dish_id = std::stoi(dish_num);
 	boost::json::object context;
 	std::cout << "" << std::endl;
-	return redirect_to_dish(conn, session_ptr, response, std::move(context), canteen_id, table_id, tag_id, dish_id);
+	return redirect_to_dish(conn, session_ptr, request, response, std::move(context), canteen_id, table_id, tag_id, dish_id);
 }
 
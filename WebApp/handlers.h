@@ -3,11 +3,21 @@
 #include <boost/json.hpp>
 
 #include <string>
+#include <vector>
 #include <memory>
 #include <optional>
 
 #include "bserv/common.hpp"
 
+#include "reference_data.h"
+
+// the canteens, windows, tags and dishes of the menu, for
+// init_reference_data.
+reference_data load_reference_data(const std::shared_ptr<bserv::db_connection>& conn);
+
+// the dish `id` with its tags, for init_reference_data.
+std::optional<dish_update> load_menu_dish(const std::shared_ptr<bserv::db_connection>& conn, int id);
+
 std::nullopt_t hello(
     bserv::response_type& response,
     std::shared_ptr<bserv::session_type> session_ptr);
@@ -44,12 +54,41 @@ std::nullopt_t ws_echo(
     std::shared_ptr<bserv::websocket_server> ws_server);
 
 std::nullopt_t serve_static_files(
+    bserv::request_type& request,
     bserv::response_type& response,
     const std::string& path);
 
-std::nullopt_t index_page(
+std::nullopt_t serve_image(
+    bserv::request_type& request,
+    bserv::response_type& response,
+    const std::string& width,
+    const std::string& path);
+
+boost::json::object view_metrics(std::shared_ptr<bserv::session_type> session_ptr);
+
+boost::json::object suggest_dishes(boost::json::object&& params);
+
+boost::json::object search_api(boost::json::object&& params);
+
+boost::json::object import_menu(
+    bserv::request_type& request,
     std::shared_ptr<bserv::db_connection> conn,
+    std::shared_ptr<bserv::session_type> session_ptr);
+
+std::nullopt_t export_menu(
+    std::shared_ptr<bserv::session_type> session_ptr,
+    bserv::request_type& request,
+    bserv::response_type& response);
+
+std::nullopt_t index_page(
+    std::shared_ptr<bserv::session_type> session_ptr,
+    bserv::request_type& request,
+    bserv::response_type& response);
+
+std::nullopt_t search_page(
+    boost::json::object&& params,
     std::shared_ptr<bserv::session_type> session_ptr,
+    bserv::request_type& request,
     bserv::response_type& response);
 
 std::nullopt_t form_login(
@@ -62,42 +101,43 @@ std::nullopt_t form_login(
 std::nullopt_t form_logout(
     std::shared_ptr<bserv::db_connection> conn,
     std::shared_ptr<bserv::session_type> session_ptr,
+    bserv::request_type& request,
     bserv::response_type& response);
 
 std::nullopt_t view_users(
-    std::shared_ptr<bserv::db_connection> conn,
     std::shared_ptr<bserv::session_type> session_ptr,
+    bserv::request_type& request,
     bserv::response_type& response,
     const std::string& page_num);
 
 std::nullopt_t canteen_management(
-    std::shared_ptr<bserv::db_connection> conn,
     std::shared_ptr<bserv::session_type> session_ptr,
+    bserv::request_type& request,
     bserv::response_type& response,
     const std::string& page_num);
 
 std::nullopt_t window_management(
-    std::shared_ptr<bserv::db_connection> conn,
     std::shared_ptr<bserv::session_type> session_ptr,
+    bserv::request_type& request,
     bserv::response_type& response,
     const std::string& page_num);
 
 std::nullopt_t dish_management(
-    std::shared_ptr<bserv::db_connection> conn,
     boost::json::object&& params,
     std::shared_ptr<bserv::session_type> session_ptr,
+    bserv::request_type& request,
     bserv::response_type& response,
     const std::string& page_num);
 
 std::nullopt_t tag_management(
-    std::shared_ptr<bserv::db_connection> conn,
     std::shared_ptr<bserv::session_type> session_ptr,
+    bserv::request_type& request,
     bserv::response_type& response,
     const std::string& page_num);
 
 std::nullopt_t dish_tag(
-    std::shared_ptr<bserv::db_connection> conn,
     std::shared_ptr<bserv::session_type> session_ptr,
+    bserv::request_type& request,
     bserv::response_type& response,
     const std::string& dish_num,
     const std::string& page_num);
@@ -240,26 +280,29 @@ boost::json::object add_remark_to_database(
     int dish_id);
 
 std::nullopt_t canteen_index(
-    std::shared_ptr<bserv::db_connection> conn,
     boost::json::object&& params,
     std::shared_ptr<bserv::session_type> session_ptr,
+    bserv::request_type& request,
     bserv::response_type& response,
     const std::string& canteen_num,
     const std::string& table_num,
     const std::string& tag_num);
 
 std::nullopt_t redirect_to_canteen_index(
-    std::shared_ptr<bserv::db_connection> conn,
+    const reference_data& data,
     std::shared_ptr<bserv::session_type> session_ptr,
+    bserv::request_type& request,
     bserv::response_type& response,
     boost::json::object&& context,
     int canteen_num,
     int table_num,
-    int tag_num);
+    const std::vector<int>& tag_nums,
+    bool match_all,
+    std::string dish_search);
 
 std::nullopt_t dish_content(
-    std::shared_ptr<bserv::db_connection> conn,
     std::shared_ptr<bserv::session_type> session_ptr,
+    bserv::request_type& request,
     bserv::response_type& response,
     const std::string& canteen_num,
     const std::string& table_num,
@@ -269,6 +312,7 @@ std::nullopt_t dish_content(
 std::nullopt_t redirect_to_dish(
     std::shared_ptr<bserv::db_connection> conn,
     std::shared_ptr<bserv::session_type> session_ptr,
+    bserv::request_type& request,
     bserv::response_type& response,
     boost::json::object&& context,
     int canteen_num,
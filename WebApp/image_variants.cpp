@@ -0,0 +1,303 @@
+#include "image_variants.h"
+#include "static_files.h"
+#include "static_content.h"
+#include "embedded_resources.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cctype>
+#include <csetjmp>
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+#include <algorithm>
+#include <cstring>
+#include <set>
+#include <mutex>
+#include <condition_variable>
+#include <stdexcept>
+
+#include <jpeglib.h>
+
+std::string image_root_;
+std::vector<int> image_widths_;
+// the variants being generated, by path. a variant is generated
+// once, by the first request for it, while the others for it wait.
+// different variants are generated in parallel.
+std::mutex generating_mutex_;
+std::condition_variable generated_cv_;
+std::set<std::string> generating_;
+
+struct rgb_image {
+	int width = 0;
+	int height = 0;
+	std::vector<unsigned char> pixels;
+};
+
+// libjpeg reports errors by calling `error_exit`, which must not
+// return. jump back to the caller instead of exiting.
+struct jpeg_error {
+	jpeg_error_mgr mgr;
+	std::jmp_buf jump;
+	char message[JMSG_LENGTH_MAX];
+};
+
+void on_jpeg_error(j_common_ptr cinfo) {
+	jpeg_error* err = (jpeg_error*)cinfo->err;
+	(*cinfo->err->format_message)(cinfo, err->message);
+	std::longjmp(err->jump, 1);
+}
+
+// the libjpeg calls that may longjmp are made from frames of their
+// own, and the state read after a longjmp (the cinfo and the output
+// buffer) is owned by the caller. the locals of the function calling
+// setjmp that change before a longjmp are indeterminate after it.
+
+// false if libjpeg failed, with the message in the error manager.
+bool read_pixels(jpeg_decompress_struct& cinfo, const std::string& data, int min_width, rgb_image& image) {
+	jpeg_error* err = (jpeg_error*)cinfo.err;
+	if (setjmp(err->jump))
+		return false;
+	jpeg_create_decompress(&cinfo);
+	jpeg_mem_src(&cinfo, (const unsigned char*)data.data(), (unsigned long)data.size());
+	jpeg_read_header(&cinfo, TRUE);
+	cinfo.out_color_space = JCS_RGB;
+	cinfo.scale_num = 1;
+	cinfo.scale_denom = 1;
+	while (cinfo.scale_denom < 8
+		&& (int)cinfo.image_width / (int)(cinfo.scale_denom * 2) >= min_width)
+		cinfo.scale_denom *= 2;
+	jpeg_start_decompress(&cinfo);
+	image.width = (int)cinfo.output_width;
+	image.height = (int)cinfo.output_height;
+	image.pixels.resize((std::size_t)image.width * image.height * 3);
+	while (cinfo.output_scanline < cinfo.output_height) {
+		JSAMPROW row = image.pixels.data() + (std::size_t)cinfo.output_scanline * image.width * 3;
+		jpeg_read_scanlines(&cinfo, &row, 1);
+	}
+	jpeg_finish_decompress(&cinfo);
+	return true;
+}
+
+// decodes `data`, letting libjpeg scale it down by 1/2, 1/4 or 1/8
+// while it is still at least `min_width` wide.
+rgb_image decode_jpeg(const std::string& data, int min_width) {
+	rgb_image image;
+	jpeg_decompress_struct cinfo;
+	jpeg_error err;
+	cinfo.err = jpeg_std_error(&err.mgr);
+	err.mgr.error_exit = on_jpeg_error;
+	bool decoded = read_pixels(cinfo, data, min_width, image);
+	jpeg_destroy_decompress(&cinfo);
+	if (!decoded)
+		throw std::runtime_error{ err.message };
+	return image;
+}
+
+// false if libjpeg failed, with the message in the error manager.
+// `*buffer` is to be freed either way.
+bool write_pixels(jpeg_compress_struct& cinfo, const rgb_image& image, int quality,
+	unsigned char** buffer, unsigned long* size) {
+	jpeg_error* err = (jpeg_error*)cinfo.err;
+	if (setjmp(err->jump))
+		return false;
+	jpeg_create_compress(&cinfo);
+	jpeg_mem_dest(&cinfo, buffer, size);
+	cinfo.image_width = (JDIMENSION)image.width;
+	cinfo.image_height = (JDIMENSION)image.height;
+	cinfo.input_components = 3;
+	cinfo.in_color_space = JCS_RGB;
+	jpeg_set_defaults(&cinfo);
+	jpeg_set_quality(&cinfo, quality, TRUE);
+	cinfo.optimize_coding = TRUE;
+	jpeg_simple_progression(&cinfo);
+	jpeg_start_compress(&cinfo, TRUE);
+	while (cinfo.next_scanline < cinfo.image_height) {
+		JSAMPROW row = (JSAMPROW)image.pixels.data() + (std::size_t)cinfo.next_scanline * image.width * 3;
+		jpeg_write_scanlines(&cinfo, &row, 1);
+	}
+	jpeg_finish_compress(&cinfo);
+	return true;
+}
+
+std::string encode_jpeg(const rgb_image& image, int quality) {
+	jpeg_compress_struct cinfo;
+	jpeg_error err;
+	unsigned char* buffer = nullptr;
+	unsigned long size = 0;
+	cinfo.err = jpeg_std_error(&err.mgr);
+	err.mgr.error_exit = on_jpeg_error;
+	bool encoded = write_pixels(cinfo, image, quality, &buffer, &size);
+	jpeg_destroy_compress(&cinfo);
+	std::string result = encoded ? std::string{ (const char*)buffer, size } : std::string{};
+	std::free(buffer);
+	if (!encoded)
+		throw std::runtime_error{ err.message };
+	return result;
+}
+
+// box filter, every output pixel averages the source pixels it covers.
+rgb_image resize(const rgb_image& src, int width) {
+	rgb_image dst;
+	dst.width = width;
+	dst.height = std::max(1, (int)((long long)src.height * width / src.width));
+	dst.pixels.resize((std::size_t)dst.width * dst.height * 3);
+	for (int y = 0; y < dst.height; ++y) {
+		int y0 = (int)((long long)y * src.height / dst.height);
+		int y1 = std::max(y0 + 1, (int)((long long)(y + 1) * src.height / dst.height));
+		for (int x = 0; x < dst.width; ++x) {
+			int x0 = (int)((long long)x * src.width / dst.width);
+			int x1 = std::max(x0 + 1, (int)((long long)(x + 1) * src.width / dst.width));
+			unsigned sum[3] = { 0, 0, 0 };
+			for (int sy = y0; sy < y1; ++sy) {
+				const unsigned char* p = src.pixels.data() + ((std::size_t)sy * src.width + x0) * 3;
+				for (int sx = x0; sx < x1; ++sx, p += 3) {
+					sum[0] += p[0];
+					sum[1] += p[1];
+					sum[2] += p[2];
+				}
+			}
+			unsigned count = (unsigned)((y1 - y0) * (x1 - x0));
+			unsigned char* q = dst.pixels.data() + ((std::size_t)y * dst.width + x) * 3;
+			for (int c = 0; c < 3; ++c)
+				q[c] = (unsigned char)((sum[c] + count / 2) / count);
+		}
+	}
+	return dst;
+}
+
+std::string variant_path(int width, const std::string& image) {
+	return "thumbs/" + std::to_string(width) + "/" + image;
+}
+
+bool is_jpeg(const std::string& image) {
+	auto dot = image.rfind('.');
+	if (dot == std::string::npos)
+		return false;
+	std::string ext = image.substr(dot + 1);
+	std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+	return ext == "jpg" || ext == "jpeg";
+}
+
+std::string read_file(const std::filesystem::path& path) {
+	std::ifstream in{ path, std::ios::binary };
+	if (!in)
+		throw std::runtime_error{ "cannot read " + path.string() };
+	std::ostringstream os;
+	os << in.rdbuf();
+	return os.str();
+}
+
+// written next to the target and renamed, so readers never
+// see a half written file.
+void write_file(const std::filesystem::path& path, const std::string& content) {
+	std::filesystem::create_directories(path.parent_path());
+	std::filesystem::path tmp = path;
+	tmp += ".tmp";
+	{
+		std::ofstream out{ tmp, std::ios::binary | std::ios::trunc };
+		out.write(content.data(), (std::streamsize)content.size());
+		if (!out)
+			throw std::runtime_error{ "cannot write " + tmp.string() };
+	}
+	std::filesystem::rename(tmp, path);
+}
+
+// the caller has put the variant in `generating_`.
+void generate_variant(int width, const std::string& image, const std::string& data) {
+	std::string result;
+	rgb_image decoded = decode_jpeg(data, width);
+	if (decoded.width < width)
+		result = data; // never upscale
+	else if (decoded.width == width)
+		result = encode_jpeg(decoded, 82);
+	else
+		result = encode_jpeg(resize(decoded, width), 82);
+	std::string name = variant_path(width, image);
+	write_file(image_root_ + name, result);
+	invalidate_static_file(name);
+}
+
+#ifdef WEBAPP_EMBED_RESOURCES
+// resource_packer writes the statics sorted by name.
+const embedded_resource* find_embedded_static(const std::string& file) {
+	std::size_t count = 0;
+	const embedded_resource* resources = embedded_statics(count);
+	auto it = std::lower_bound(resources, resources + count, file,
+		[](const embedded_resource& r, const std::string& name) {
+			return std::strcmp(r.name, name.c_str()) < 0; });
+	if (it == resources + count || file != it->name)
+		return nullptr;
+	return it;
+}
+#endif
+
+void init_image_variants(
+	const std::string& static_root,
+	const std::vector<int>& widths) {
+	image_root_ = static_root;
+	if (image_root_[image_root_.size() - 1] != '/')
+		image_root_.push_back('/');
+	image_widths_ = widths;
+	std::sort(image_widths_.begin(), image_widths_.end());
+}
+
+std::nullopt_t serve_image_variant(
+	const bserv::request_type& request,
+	bserv::response_type& response,
+	const std::string& width,
+	const std::string& image) {
+	int w = std::atoi(width.c_str());
+	if (!is_safe_path(image) || !is_jpeg(image)
+		|| !std::binary_search(image_widths_.begin(), image_widths_.end(), w))
+		throw bserv::url_not_found_exception{};
+	std::filesystem::path source{ image_root_ + image };
+	std::filesystem::path variant{ image_root_ + variant_path(w, image) };
+	// in embedded mode the original is in the binary and only
+	// its variants are written to the static root.
+	const embedded_resource* embedded = nullptr;
+	std::time_t source_time = 0;
+	std::error_code ec;
+	if (std::filesystem::is_regular_file(source, ec))
+		source_time = file_mtime(source);
+	else {
+#ifdef WEBAPP_EMBED_RESOURCES
+		embedded = find_embedded_static(image);
+#endif
+		if (embedded == nullptr)
+			throw bserv::url_not_found_exception{};
+		source_time = embedded->mtime;
+	}
+	auto is_fresh = [&]() {
+		std::error_code ec;
+		return std::filesystem::is_regular_file(variant, ec)
+			&& file_mtime(variant) >= source_time;
+	};
+	if (!is_fresh()) {
+		std::string name = variant_path(w, image);
+		std::unique_lock<std::mutex> lock{ generating_mutex_ };
+		generated_cv_.wait(lock, [&] { return generating_.count(name) == 0; });
+		if (!is_fresh()) {
+			generating_.insert(name);
+			lock.unlock();
+			bool generated = true;
+			try {
+				generate_variant(w, image, embedded != nullptr
+					? std::string{ (const char*)embedded->data, embedded->size }
+					: read_file(source));
+			}
+			catch (const std::exception& e) {
+				lgwarning << "image variant of `" << image << "`: " << e.what() << std::endl;
+				generated = false;
+			}
+			lock.lock();
+			generating_.erase(name);
+			lock.unlock();
+			generated_cv_.notify_all();
+			// the original is still better than nothing
+			if (!generated)
+				return serve(request, response, image);
+		}
+	}
+	return serve(request, response, variant_path(w, image));
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <optional>
+
+#include "bserv/common.hpp"
+
+// resized copies of the jpeg images under the static root are
+// kept in `thumbs/<width>/` there. only `widths` are generated.
+void init_image_variants(
+	const std::string& static_root,
+	const std::vector<int>& widths = { 240, 480, 750, 1500 });
+
+// serves the `width` variant of `image`, generating it first if
+// it is missing or older than the original. a dish write does not
+// generate its variants, the first request for each one does.
+std::nullopt_t serve_image_variant(
+	const bserv::request_type& request,
+	bserv::response_type& response,
+	const std::string& width,
+	const std::string& image);
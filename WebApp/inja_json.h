@@ -0,0 +1,9 @@
+#pragma once
+
+#include <boost/json.hpp>
+#include <inja/inja.hpp>
+
+// the inja (nlohmann) tree of a boost.json context, built without
+// serializing it to text. defined in rendering.cpp, also used by
+// render_bench.
+inja::json to_inja_json(const boost::json::object& obj);
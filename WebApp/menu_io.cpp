@@ -0,0 +1,327 @@
+#include "menu_io.h"
+
+#include <array>
+#include <cctype>
+#include <optional>
+#include <stdexcept>
+
+const char* const menu_columns[10] = {
+	"C_", "Cname", "Cpicture", "Wname", "Wlocation",
+	"Dname", "Dprice", "is_sell", "Dpicture", "tags"
+};
+
+namespace {
+
+	constexpr std::size_t column_count = sizeof(menu_columns) / sizeof(menu_columns[0]);
+
+	// the menu columns, then the line (or json row) the row came
+	// from, for the errors of the merge.
+	using menu_row = std::array<std::optional<std::string>, column_count + 1>;
+
+	// rows per fetch of the export cursor
+	constexpr long export_batch = 1000;
+
+	// typed copy of the staging table, so the statements below do
+	// not cast. every row has a Cname, add() checks it.
+	const char* const prepare_rows_sql =
+		"create temp table menu_rows on commit drop as "
+		"select C_::integer as C_, Cname, Cpicture, Wname, Wlocation, Dname, "
+		"Dprice::real as Dprice, coalesce(is_sell::boolean, TRUE) as is_sell, Dpicture, "
+		"array_remove(string_to_array(tags, '|'), '') as tags, line::integer as line "
+		"from menu_import;"
+		"analyze menu_rows;";
+
+	const char* const merge_canteens_sql =
+		"insert into canteen (C_, Cname, Cpicture) "
+		"select distinct on (C_) C_, Cname, Cpicture from menu_rows "
+		"where C_ is not null order by C_ "
+		"on conflict (C_) do update set Cname = excluded.Cname, "
+		"Cpicture = coalesce(excluded.Cpicture, canteen.Cpicture);";
+
+	// rows without C_ belong to the canteen with their Cname, which
+	// the upsert above may have renamed.
+	const char* const resolve_canteens_sql =
+		"update menu_rows r set C_ = canteen.C_ from canteen "
+		"where r.C_ is null and canteen.Cname = r.Cname;";
+
+	// the first row whose canteen is neither given by C_ nor exists.
+	const char* const unplaced_row_sql =
+		"select line, Cname from menu_rows where C_ is null order by line limit 1;";
+
+	const char* const insert_windows_sql =
+		"insert into win (Wname, Wlocation, C_) "
+		"select distinct on (r.C_, r.Wname) r.Wname, r.Wlocation, r.C_ from menu_rows r "
+		"where r.Wname is not null and not exists "
+		"(select * from win where win.C_ = r.C_ and win.Wname = r.Wname) "
+		"order by r.C_, r.Wname;";
+
+	const char* const update_windows_sql =
+		"update win set Wlocation = r.Wlocation "
+		"from (select distinct on (C_, Wname) C_, Wname, Wlocation from menu_rows "
+		"where Wname is not null and Wlocation is not null order by C_, Wname) r "
+		"where win.C_ = r.C_ and win.Wname = r.Wname "
+		"and win.Wlocation is distinct from r.Wlocation;";
+
+	// the window of each dish row
+	const char* const dish_rows_sql =
+		"create temp table menu_dishes on commit drop as "
+		"select distinct on (win.W_, r.Dname) win.W_, r.Dname, r.Dprice, r.is_sell, r.Dpicture, r.tags "
+		"from menu_rows r join win on win.C_ = r.C_ and win.Wname = r.Wname "
+		"where r.Dname is not null order by win.W_, r.Dname;"
+		"analyze menu_dishes;";
+
+	const char* const insert_dishes_sql =
+		"insert into dish (Dname, Dprice, is_sell, Dpicture, W_) "
+		"select r.Dname, r.Dprice, r.is_sell, r.Dpicture, r.W_ from menu_dishes r "
+		"where not exists (select * from dish where dish.W_ = r.W_ and dish.Dname = r.Dname);";
+
+	const char* const update_dishes_sql =
+		"update dish set Dprice = r.Dprice, is_sell = r.is_sell, "
+		"Dpicture = coalesce(r.Dpicture, dish.Dpicture) from menu_dishes r "
+		"where dish.W_ = r.W_ and dish.Dname = r.Dname and "
+		"(dish.Dprice, dish.is_sell, dish.Dpicture) is distinct from "
+		"(r.Dprice, r.is_sell, coalesce(r.Dpicture, dish.Dpicture));";
+
+	const char* const insert_tags_sql =
+		"insert into tag (Tname, Tsupport) "
+		"select distinct t.Tname, 0 from menu_dishes r, unnest(r.tags) as t(Tname) "
+		"where not exists (select * from tag where tag.Tname = t.Tname);";
+
+	const char* const insert_dish_tags_sql =
+		"insert into tag_belong (T_, D_) "
+		"select distinct tag.T_, dish.D_ from menu_dishes r "
+		"join dish on dish.W_ = r.W_ and dish.Dname = r.Dname "
+		"cross join unnest(r.tags) as t(Tname) join tag on tag.Tname = t.Tname "
+		"on conflict do nothing;";
+
+	const char* const export_sql =
+		"select canteen.C_, Cname, Cpicture, Wname, Wlocation, Dname, Dprice, is_sell, Dpicture, "
+		"(select string_agg(tag.Tname, '|' order by tag.Tname) from tag, tag_belong "
+		"where tag.T_ = tag_belong.T_ and tag_belong.D_ = dish.D_) "
+		"from canteen left join win on win.C_ = canteen.C_ left join dish on dish.W_ = win.W_ "
+		"order by canteen.C_, win.W_, dish.D_";
+
+	std::size_t column_index(const std::string& name) {
+		for (std::size_t i = 0; i < column_count; ++i)
+			if (name == menu_columns[i])
+				return i;
+		throw std::invalid_argument{ "unknown menu column `" + name + "`" };
+	}
+
+	// streams rows into the staging table and merges them.
+	class menu_importer {
+	public:
+		// `unit` names what the rows are numbered by in errors.
+		menu_importer(pqxx::connection& conn, std::string unit)
+			: tx_{ conn }, stream_{ tx_, create_staging(tx_), staging_columns() }, unit_{ std::move(unit) } {}
+
+		void add(menu_row& row, std::size_t line) {
+			// the merge cannot place a row without its canteen name
+			static const std::size_t cname = column_index("Cname");
+			if (!row[cname])
+				throw std::invalid_argument{ unit_ + " " + std::to_string(line) + " has no Cname" };
+			row[column_count] = std::to_string(line);
+			stream_ << row;
+			++result_.rows;
+		}
+
+		menu_import_result finish() {
+			stream_.complete();
+			// imports of the same window or dish must not interleave
+			tx_.exec0("lock table canteen, win, dish, tag in share row exclusive mode;");
+			tx_.exec0(prepare_rows_sql);
+			result_.canteens = tx_.exec0(merge_canteens_sql).affected_rows();
+			tx_.exec0(resolve_canteens_sql);
+			pqxx::result unplaced = tx_.exec(unplaced_row_sql);
+			if (!unplaced.empty())
+				throw std::invalid_argument{ unit_ + " " + unplaced[0][0].as<std::string>()
+					+ ": there is no canteen named `" + unplaced[0][1].as<std::string>()
+					+ "`, a new canteen needs its C_" };
+			result_.windows = tx_.exec0(insert_windows_sql).affected_rows()
+				+ tx_.exec0(update_windows_sql).affected_rows();
+			tx_.exec0(dish_rows_sql);
+			result_.dishes = tx_.exec0(insert_dishes_sql).affected_rows()
+				+ tx_.exec0(update_dishes_sql).affected_rows();
+			result_.tags = tx_.exec0(insert_tags_sql).affected_rows();
+			result_.dish_tags = tx_.exec0(insert_dish_tags_sql).affected_rows();
+			tx_.commit();
+			return result_;
+		}
+
+	private:
+		// the staging table, for the copy to stream into.
+		static std::string create_staging(pqxx::work& tx) {
+			std::string sql = "create temp table menu_import (";
+			for (const auto& column : staging_columns())
+				sql += (sql.back() == '(' ? "" : ", ") + column + " text";
+			tx.exec0(sql + ") on commit drop;");
+			return "menu_import";
+		}
+
+		// the menu columns as postgres folds them, in case the copy
+		// quotes them.
+		static std::vector<std::string> staging_columns() {
+			std::vector<std::string> columns;
+			for (const char* name : menu_columns) {
+				columns.emplace_back(name);
+				for (char& c : columns.back())
+					c = (char)std::tolower((unsigned char)c);
+			}
+			columns.emplace_back("line");
+			return columns;
+		}
+
+		pqxx::work tx_;
+		pqxx::stream_to stream_;
+		std::string unit_;
+		menu_import_result result_;
+	};
+
+	// reads one csv record (rfc 4180), false at the end of the input.
+	bool read_record(std::istream& in, std::vector<std::string>& fields) {
+		fields.clear();
+		int c = in.get();
+		if (c == EOF)
+			return false;
+		std::string field;
+		bool quoted = false;
+		for (;; c = in.get()) {
+			if (quoted) {
+				if (c == EOF)
+					throw std::invalid_argument{ "unterminated quoted csv field" };
+				if (c == '"') {
+					if (in.peek() == '"')
+						field += (char)in.get();
+					else
+						quoted = false;
+				}
+				else {
+					field += (char)c;
+				}
+			}
+			else if (c == '"') {
+				quoted = true;
+			}
+			else if (c == ',') {
+				fields.push_back(std::move(field));
+				field.clear();
+			}
+			else if (c == '\r' || c == '\n' || c == EOF) {
+				if (c == '\r' && in.peek() == '\n')
+					in.get();
+				fields.push_back(std::move(field));
+				return true;
+			}
+			else {
+				field += (char)c;
+			}
+		}
+	}
+
+	void write_field(std::ostream& out, const pqxx::field& field) {
+		if (field.is_null())
+			return;
+		std::string_view value = field.view();
+		if (value.find_first_of(",\"\r\n") == std::string_view::npos) {
+			out << value;
+			return;
+		}
+		out << '"';
+		for (char c : value) {
+			if (c == '"')
+				out << '"';
+			out << c;
+		}
+		out << '"';
+	}
+
+	std::optional<std::string> json_field(const boost::json::value& value) {
+		switch (value.kind()) {
+		case boost::json::kind::null:
+			return std::nullopt;
+		case boost::json::kind::string: {
+			const auto& str = value.as_string();
+			if (str.empty())
+				return std::nullopt;
+			return std::string{ str.data(), str.size() };
+		}
+		case boost::json::kind::array: {
+			std::string joined;
+			for (const auto& item : value.as_array()) {
+				if (!joined.empty())
+					joined += '|';
+				joined += item.as_string().c_str();
+			}
+			return joined;
+		}
+		default:
+			return boost::json::serialize(value);
+		}
+	}
+
+} // namespace
+
+menu_import_result import_menu_csv(pqxx::connection& conn, std::istream& in) {
+	std::vector<std::string> fields;
+	if (!read_record(in, fields))
+		throw std::invalid_argument{ "the menu file is empty" };
+	std::vector<std::size_t> columns;
+	for (const auto& name : fields)
+		columns.push_back(column_index(name));
+	menu_importer importer{ conn, "line" };
+	for (std::size_t line = 2; read_record(in, fields); ++line) {
+		if (fields.size() == 1 && fields[0].empty())
+			continue;
+		if (fields.size() != columns.size())
+			throw std::invalid_argument{ "line " + std::to_string(line) + " has "
+				+ std::to_string(fields.size()) + " fields, expected " + std::to_string(columns.size()) };
+		menu_row row;
+		for (std::size_t i = 0; i < columns.size(); ++i)
+			if (!fields[i].empty())
+				row[columns[i]] = std::move(fields[i]);
+		importer.add(row, line);
+	}
+	return importer.finish();
+}
+
+menu_import_result import_menu_json(pqxx::connection& conn, const boost::json::array& rows) {
+	menu_importer importer{ conn, "row" };
+	std::size_t index = 0;
+	for (const auto& value : rows) {
+		menu_row row;
+		for (const auto& item : value.as_object())
+			row[column_index(std::string{ item.key() })] = json_field(item.value());
+		importer.add(row, ++index);
+	}
+	return importer.finish();
+}
+
+void export_menu_csv(pqxx::connection& conn, std::ostream& out) {
+	pqxx::read_transaction tx{ conn };
+	for (std::size_t i = 0; i < column_count; ++i)
+		out << (i == 0 ? "" : ",") << menu_columns[i];
+	out << "\r\n";
+	pqxx::icursorstream cursor{ tx, export_sql, "menu_export", export_batch };
+	pqxx::result rows;
+	while (cursor >> rows) {
+		for (const auto& row : rows) {
+			for (std::size_t i = 0; i < column_count; ++i) {
+				if (i != 0)
+					out << ',';
+				write_field(out, row[(int)i]);
+			}
+			out << "\r\n";
+		}
+	}
+}
+
+boost::json::object to_json(const menu_import_result& result) {
+	return {
+		{"rows", result.rows},
+		{"canteens", result.canteens},
+		{"windows", result.windows},
+		{"dishes", result.dishes},
+		{"tags", result.tags},
+		{"dish_tags", result.dish_tags}
+	};
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <string>
+#include <istream>
+#include <ostream>
+
+#include <pqxx/pqxx>
+#include <boost/json.hpp>
+
+// a menu file has one row per dish, with its window and canteen:
+//   C_,Cname,Cpicture,Wname,Wlocation,Dname,Dprice,is_sell,Dpicture,tags
+// tags are separated by `|`. canteens are upserted by C_: a new C_
+// adds the canteen, a known one renames it to Cname. a row without
+// C_ belongs to the canteen named Cname, which must exist. windows
+// are matched by canteen and Wname, dishes by window and Dname. a
+// row without Dname (or Wname) only adds its canteen (and window).
+// every row needs Cname. columns may be left out, empty fields are
+// null.
+extern const char* const menu_columns[10];
+
+struct menu_import_result {
+	std::size_t rows = 0;
+	// rows added or changed in each table
+	std::size_t canteens = 0;
+	std::size_t windows = 0;
+	std::size_t dishes = 0;
+	std::size_t tags = 0;
+	std::size_t dish_tags = 0;
+};
+
+// copies the rows into a staging table with COPY, then merges them
+// into the menu tables with a few set based statements, all in one
+// transaction on `conn`. throws if the file or a row is invalid,
+// naming the line of the row.
+menu_import_result import_menu_csv(pqxx::connection& conn, std::istream& in);
+
+// the same for a json array of objects with the menu columns as
+// keys. tags may also be an array of strings.
+menu_import_result import_menu_json(pqxx::connection& conn, const boost::json::array& rows);
+
+// writes the whole menu as csv, read through a server side cursor
+// a batch of rows at a time. what `out` holds is up to it.
+void export_menu_csv(pqxx::connection& conn, std::ostream& out);
+
+boost::json::object to_json(const menu_import_result& result);
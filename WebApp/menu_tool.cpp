@@ -0,0 +1,57 @@
+// menu_tool: loads or dumps the canteen menus without the server,
+// for files too large to post to /menu_import. csv is streamed both
+// ways. json is parsed into a whole document first, so large menus
+// are better loaded as csv. see `menu_io.h` for the file format.
+//
+// usage: menu_tool import <conn-str> <menu.csv | menu.json>
+//        menu_tool export <conn-str> <menu.csv>
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <cstdlib>
+#include <stdexcept>
+
+#include "menu_io.h"
+
+int main(int argc, char* argv[]) {
+	std::string command = argc == 4 ? argv[1] : "";
+	if (command != "import" && command != "export") {
+		std::cerr << "usage: " << argv[0] << " import <conn-str> <menu.csv | menu.json>\n"
+			<< "       " << argv[0] << " export <conn-str> <menu.csv>" << std::endl;
+		return EXIT_FAILURE;
+	}
+	try {
+		pqxx::connection conn{ argv[2] };
+		std::string path = argv[3];
+		if (command == "export") {
+			std::ofstream out{ path, std::ios::binary | std::ios::trunc };
+			if (!out)
+				throw std::runtime_error{ "cannot write " + path };
+			export_menu_csv(conn, out);
+			return EXIT_SUCCESS;
+		}
+		std::ifstream in{ path, std::ios::binary };
+		if (!in)
+			throw std::runtime_error{ "cannot read " + path };
+		menu_import_result result;
+		if (path.size() >= 5 && path.compare(path.size() - 5, 5, ".json") == 0) {
+			// fed in chunks, so the text is not held next to the document
+			boost::json::stream_parser parser;
+			char chunk[64 * 1024];
+			while (in.read(chunk, sizeof(chunk)) || in.gcount() > 0)
+				parser.write(chunk, (std::size_t)in.gcount());
+			parser.finish();
+			result = import_menu_json(conn, parser.release().as_array());
+		}
+		else {
+			result = import_menu_csv(conn, in);
+		}
+		std::cout << boost::json::serialize(to_json(result)) << std::endl;
+	}
+	catch (const std::exception& e) {
+		std::cerr << e.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
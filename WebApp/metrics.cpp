@@ -0,0 +1,58 @@
+#include "metrics.h"
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <chrono>
+
+#ifdef __linux__
+#include <time.h>
+#endif
+
+std::mutex metrics_mutex_;
+
+// function statics, metrics may be registered during static
+// initialization of other files.
+std::map<std::string, std::unique_ptr<metric_counter>>& counters() {
+	static std::map<std::string, std::unique_ptr<metric_counter>> counters;
+	return counters;
+}
+
+std::map<std::string, std::function<double()>>& gauges() {
+	static std::map<std::string, std::function<double()>> gauges;
+	return gauges;
+}
+
+metric_counter& get_counter(const std::string& name) {
+	std::lock_guard<std::mutex> lock{ metrics_mutex_ };
+	auto& counter = counters()[name];
+	if (counter == nullptr)
+		counter = std::make_unique<metric_counter>();
+	return *counter;
+}
+
+void register_gauge(const std::string& name, std::function<double()> gauge) {
+	std::lock_guard<std::mutex> lock{ metrics_mutex_ };
+	gauges()[name] = std::move(gauge);
+}
+
+boost::json::object metrics_snapshot() {
+	std::lock_guard<std::mutex> lock{ metrics_mutex_ };
+	boost::json::object result;
+	for (const auto& [name, counter] : counters())
+		result[name] = counter->get();
+	for (const auto& [name, gauge] : gauges())
+		result[name] = gauge();
+	return result;
+}
+
+std::uint64_t thread_cpu_time_ns() {
+#ifdef __linux__
+	timespec ts;
+	if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0)
+		return (std::uint64_t)ts.tv_sec * 1000000000 + (std::uint64_t)ts.tv_nsec;
+#endif
+	// wall time is the best we can do elsewhere
+	return (std::uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
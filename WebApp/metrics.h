@@ -0,0 +1,35 @@
+#pragma once
+
+#include <string>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+
+#include <boost/json.hpp>
+
+// a named value that only grows, safe to update from any thread.
+class metric_counter {
+public:
+	void add(std::uint64_t n = 1) {
+		value_.fetch_add(n, std::memory_order_relaxed);
+	}
+	std::uint64_t get() const {
+		return value_.load(std::memory_order_relaxed);
+	}
+private:
+	std::atomic<std::uint64_t> value_{ 0 };
+};
+
+// the counter registered as `name`, created on first use. the
+// reference stays valid, so callers can keep it in a static.
+metric_counter& get_counter(const std::string& name);
+
+// a value computed from other metrics when they are read. it
+// runs under the registry lock, so capture counters beforehand.
+void register_gauge(const std::string& name, std::function<double()> gauge);
+
+// every counter and gauge by name.
+boost::json::object metrics_snapshot();
+
+// cpu time used so far by the calling thread, in nanoseconds.
+std::uint64_t thread_cpu_time_ns();
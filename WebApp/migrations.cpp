@@ -0,0 +1,77 @@
+#include "migrations.h"
+
+#include <pqxx/pqxx>
+
+#include "bserv/common.hpp"
+
+namespace {
+
+	// append only: a migration that has been released is never
+	// edited, a fix is a new migration.
+	const migration migrations_[] = {
+		{ 1, "index the foreign keys",
+			"create index if not exists win_c_idx on win (C_);"
+			"create index if not exists dish_w_idx on dish (W_);"
+			"create index if not exists remark_d_idx on remark (D_);"
+			"create index if not exists remark_id_idx on remark (id);"
+			"create index if not exists tag_belong_d_idx on tag_belong (D_);" },
+		// a plain btree only serves `like 'x%'` in the C collation,
+		// the pattern ops compare bytes in any collation.
+		{ 2, "index dish names for prefix search",
+			"create index if not exists dish_dname_pattern_idx on dish (Dname varchar_pattern_ops);" },
+		// kept up to date by add_dish_score and remove_dish_score.
+		{ 3, "aggregate the scores of each dish",
+			"create table if not exists dish_stats ("
+			"D_ integer PRIMARY KEY, "
+			"remarks integer NOT NULL default 0, "
+			"score_sum bigint NOT NULL default 0, "
+			"histogram integer[] NOT NULL default array_fill(0, array[10]), "
+			"FOREIGN KEY(D_) REFERENCES dish(D_) on delete cascade);"
+			"insert into dish_stats (D_, remarks, score_sum) "
+			"select D_, count(*), sum(Rmark) from remark where Rmark is not null group by D_;"
+			"update dish_stats set histogram = array("
+			"select count(remark.R_)::integer from generate_series(0, 9) as bucket(b) "
+			"left join remark on remark.D_ = dish_stats.D_ and Rmark is not null "
+			"and least(greatest(Rmark, 0), 99) / 10 = bucket.b "
+			"group by bucket.b order by bucket.b);" },
+	};
+
+	// serializes the migrations of servers that start together.
+	const long long migrations_lock = 0x6d6967726174;
+
+} // namespace
+
+void run_migrations(const std::string& conn_str) {
+	pqxx::connection conn{ conn_str };
+	{
+		pqxx::work tx{ conn };
+		tx.exec0(
+			"create table if not exists schema_migrations ("
+			"version integer primary key, "
+			"description character varying(255) NOT NULL, "
+			"applied_at timestamp NOT NULL default now());");
+		tx.commit();
+	}
+	int latest = 0;
+	for (const migration& m : migrations_) {
+		pqxx::work tx{ conn };
+		tx.exec_params("select pg_advisory_xact_lock($1);", migrations_lock);
+		if (!tx.exec_params("select 1 from schema_migrations where version = $1;", m.version).empty()) {
+			latest = m.version;
+			continue;
+		}
+		lginfo << "applying migration " << m.version << ": " << m.description << std::endl;
+		tx.exec0(m.sql);
+		tx.exec_params("insert into schema_migrations (version, description) values ($1, $2);",
+			m.version, m.description);
+		tx.commit();
+		latest = m.version;
+	}
+	pqxx::work tx{ conn };
+	int version = tx.exec("select coalesce(max(version), 0) from schema_migrations;")
+		.one_field().as<int>();
+	if (version > latest)
+		lgwarning << "the database schema (version " << version
+			<< ") is newer than this server (version " << latest << ")" << std::endl;
+	lginfo << "schema version: " << version << std::endl;
+}
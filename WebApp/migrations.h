@@ -0,0 +1,16 @@
+#pragma once
+
+#include <string>
+
+// a numbered change to the schema of db.sql. migrations are applied
+// in version order, each in its own transaction.
+struct migration {
+	int version;
+	const char* description;
+	const char* sql;
+};
+
+// applies the migrations newer than the version recorded in the
+// `schema_migrations` table of the database at `conn_str`, and
+// records each one. throws if a migration fails.
+void run_migrations(const std::string& conn_str);
@@ -0,0 +1,210 @@
+#include "pagination.h"
+
+#include <charconv>
+#include <chrono>
+#include <mutex>
+#include <unordered_map>
+
+namespace {
+
+	const char cursor_digits[] =
+		"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+	const char cursor_directions[] = "abe";
+
+	// a count is used for a minute. it only numbers the last page
+	// link, which a few rows more or less do not break.
+	constexpr std::chrono::seconds count_lifetime{ 60 };
+	constexpr std::size_t max_counts = 1024;
+
+	struct stored_count {
+		std::size_t count;
+		std::chrono::steady_clock::time_point time;
+	};
+
+	std::mutex counts_mutex_;
+	std::unordered_map<std::string, stored_count> counts_;
+
+} // namespace
+
+// the direction and key, base64url encoded so that the
+// links do not read as something to edit.
+std::string encode_cursor(const page_cursor& cursor) {
+	std::string plain = cursor_directions[(int)cursor.from] + std::to_string(cursor.key);
+	std::string token;
+	unsigned int bits = 0;
+	int count = 0;
+	for (unsigned char c : plain) {
+		bits = (bits << 8) | c;
+		count += 8;
+		while (count >= 6) {
+			count -= 6;
+			token += cursor_digits[(bits >> count) & 0x3f];
+		}
+	}
+	if (count > 0)
+		token += cursor_digits[(bits << (6 - count)) & 0x3f];
+	return token;
+}
+
+std::optional<page_cursor> request_cursor(const bserv::request_type& request) {
+	std::string_view target{ request.target().data(), request.target().size() };
+	std::size_t pos = target.find('?');
+	if (pos == std::string_view::npos)
+		return std::nullopt;
+	std::string_view token;
+	for (std::string_view query = target.substr(pos + 1); !query.empty();) {
+		std::size_t end = std::min(query.find('&'), query.size());
+		if (query.substr(0, 7) == "cursor=")
+			token = query.substr(7, end - 7);
+		query.remove_prefix(std::min(end + 1, query.size()));
+	}
+	std::string plain;
+	unsigned int bits = 0;
+	int count = 0;
+	for (char c : token) {
+		const char* digit = std::char_traits<char>::find(cursor_digits, 64, c);
+		if (digit == nullptr)
+			return std::nullopt;
+		bits = (bits << 6) | (unsigned int)(digit - cursor_digits);
+		count += 6;
+		if (count >= 8) {
+			count -= 8;
+			plain += (char)((bits >> count) & 0xff);
+		}
+	}
+	const char* direction = plain.empty() ? nullptr : std::char_traits<char>::find(cursor_directions, 3, plain[0]);
+	if (plain.size() < 2 || direction == nullptr)
+		return std::nullopt;
+	page_cursor cursor{ (page_cursor::direction)(direction - cursor_directions), 0 };
+	auto res = std::from_chars(plain.data() + 1, plain.data() + plain.size(), cursor.key);
+	if (res.ec != std::errc{} || res.ptr != plain.data() + plain.size())
+		return std::nullopt;
+	// the rows of the last page
+	if (cursor.from == page_cursor::direction::last && (cursor.key < 1 || cursor.key > page_size))
+		return std::nullopt;
+	return cursor;
+}
+
+std::optional<std::size_t> cached_count(const std::string& key) {
+	std::lock_guard<std::mutex> lock{ counts_mutex_ };
+	auto it = counts_.find(key);
+	if (it == counts_.end() || std::chrono::steady_clock::now() - it->second.time > count_lifetime)
+		return std::nullopt;
+	return it->second.count;
+}
+
+void store_count(const std::string& key, std::size_t count) {
+	auto now = std::chrono::steady_clock::now();
+	std::lock_guard<std::mutex> lock{ counts_mutex_ };
+	if (counts_.size() >= max_counts) {
+		// searches have a key each, the old ones go
+		for (auto it = counts_.begin(); it != counts_.end();) {
+			if (now - it->second.time > count_lifetime)
+				it = counts_.erase(it);
+			else
+				++it;
+		}
+		if (counts_.size() >= max_counts)
+			counts_.clear();
+	}
+	counts_[key] = { count, now };
+}
+
+void link_pages(
+	page_result& page,
+	const std::vector<std::int64_t>& page_keys,
+	const std::vector<std::int64_t>& before,
+	const std::vector<std::int64_t>& after) {
+	std::size_t rows = (std::size_t)page_size;
+	// the k-th page after this one starts after the last row of
+	// the one before it
+	if (!page_keys.empty() && !after.empty()) {
+		page.next_cursors.push_back(encode_cursor({ page_cursor::direction::after, page_keys.back() }));
+		for (std::size_t k = 1; k <= page_window && after.size() > k * rows; ++k)
+			page.next_cursors.push_back(encode_cursor({ page_cursor::direction::after, after[k * rows - 1] }));
+	}
+	// and the k-th page before ends before the first row of the one
+	// after it
+	if (!page_keys.empty() && !before.empty()) {
+		page.previous_cursors.push_back(encode_cursor({ page_cursor::direction::before, page_keys.front() }));
+		for (std::size_t k = 1; k < page_window && before.size() > k * rows; ++k)
+			page.previous_cursors.push_back(encode_cursor({ page_cursor::direction::before, before[k * rows - 1] }));
+	}
+}
+
+void set_pagination(boost::json::object& context, int page_id, const page_result& page) {
+	if (page.rows.empty() && page.total_pages == 0)
+		return;
+	// the keys read reach the last page, unless there are more
+	int total_pages = page_id + (int)page.next_cursors.size();
+	if (page.rows.empty())
+		total_pages = (int)page.total_pages;
+	else if (page.total_pages != 0)
+		total_pages = std::max((int)page.total_pages, total_pages + 1);
+	lgdebug << "total pages: " << total_pages << std::endl;
+	// the cursor of page `i`, if it is known
+	auto cursor_of = [&](int i) -> const std::string* {
+		if (i < page_id && page_id - i <= (int)page.previous_cursors.size())
+			return &page.previous_cursors[page_id - i - 1];
+		if (i > page_id && i - page_id <= (int)page.next_cursors.size())
+			return &page.next_cursors[i - page_id - 1];
+		if (i == total_pages && !page.last_cursor.empty())
+			return &page.last_cursor;
+		return nullptr;
+	};
+	// null where page `i` has no cursor, it is then read by offset
+	auto cursor_value = [&](int i) -> boost::json::value {
+		if (const std::string* cursor = cursor_of(i))
+			return boost::json::value(*cursor);
+		return nullptr;
+	};
+	boost::json::object pagination;
+	pagination["total"] = total_pages;
+	if (page_id > 1) {
+		// past the end, back to the last page
+		int previous = page.rows.empty() ? std::min(page_id - 1, total_pages) : page_id - 1;
+		pagination["previous"] = previous;
+		if (const std::string* cursor = cursor_of(previous))
+			pagination["previous_cursor"] = *cursor;
+	}
+	if (page_id < total_pages) {
+		pagination["next"] = page_id + 1;
+		if (const std::string* cursor = cursor_of(page_id + 1))
+			pagination["next_cursor"] = *cursor;
+	}
+	int lower = page_id - page_window;
+	int upper = page_id + page_window;
+	if (page_id - page_window > 2) {
+		pagination["left_ellipsis"] = true;
+	}
+	else {
+		lower = 1;
+	}
+	if (page_id + page_window < total_pages - 1) {
+		pagination["right_ellipsis"] = true;
+		if (!page.last_cursor.empty())
+			pagination["last_cursor"] = page.last_cursor;
+	}
+	else {
+		upper = total_pages;
+	}
+	pagination["current"] = page_id;
+	// the cursors of the numbered links, at the same index as their
+	// page in pages_left and pages_right
+	boost::json::array pages_left, pages_left_cursors;
+	for (int i = lower; i < page_id; ++i) {
+		pages_left.push_back(i);
+		pages_left_cursors.push_back(cursor_value(i));
+	}
+	pagination["pages_left"] = pages_left;
+	pagination["pages_left_cursors"] = pages_left_cursors;
+	boost::json::array pages_right, pages_right_cursors;
+	for (int i = page_id + 1; i <= upper; ++i) {
+		pages_right.push_back(i);
+		pages_right_cursors.push_back(cursor_value(i));
+	}
+	pagination["pages_right"] = pages_right;
+	pagination["pages_right_cursors"] = pages_right_cursors;
+	context["pagination"] = pagination;
+}
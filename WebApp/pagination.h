@@ -0,0 +1,176 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <optional>
+#include <cstdint>
+#include <algorithm>
+
+#include <boost/json.hpp>
+#include "bserv/common.hpp"
+
+// rows per page of the management pages.
+constexpr int page_size = 10;
+
+// numbered page links shown on each side of the current page.
+constexpr int page_window = 3;
+
+struct page_result {
+	boost::json::array rows;
+	// opaque tokens for the `cursor` url parameter of the pages
+	// before this one, nearest first, up to page_window of them.
+	std::vector<std::string> previous_cursors;
+	// and of the pages after it, up to page_window + 1 of them.
+	std::vector<std::string> next_cursors;
+	// set if there are more pages than next_cursors reaches (or no
+	// rows on this page): the number of pages from a cached count,
+	// and the cursor of the last page.
+	std::size_t total_pages = 0;
+	std::string last_cursor;
+};
+
+// a position in a list ordered by its key: the rows after (or
+// before) the row with `key`, or the last `key` rows.
+struct page_cursor {
+	enum class direction { after, before, last };
+	direction from;
+	std::int64_t key;
+};
+
+std::string encode_cursor(const page_cursor& cursor);
+
+// the `cursor` url parameter of `request`, if it is a valid one.
+std::optional<page_cursor> request_cursor(const bserv::request_type& request);
+
+// the count stored under `key` if it is recent enough.
+std::optional<std::size_t> cached_count(const std::string& key);
+
+void store_count(const std::string& key, std::size_t count);
+
+inline std::string count_key_part(const std::string& value) {
+	return value;
+}
+
+template <typename T>
+std::string count_key_part(const T& value) {
+	return std::to_string(value);
+}
+
+// the number of rows of `query`, counted again after a while. the
+// page links only need it to number the last page.
+template <typename ...Params>
+std::size_t row_count(
+	bserv::db_transaction& tx,
+	const std::string& query,
+	const Params&... params) {
+	std::string key = query;
+	((key += '\x1f' + count_key_part(params)), ...);
+	if (std::optional<std::size_t> count = cached_count(key))
+		return *count;
+	bserv::db_result db_res = tx.exec("select count(*) from (" + query + ") as page_;", params...);
+	lginfo << db_res.query();
+	std::size_t count = (*db_res.begin())[0].as<std::size_t>();
+	store_count(key, count);
+	return count;
+}
+
+// sets the cursors of `page` from the keys of its rows and of the
+// rows before and after it, nearest first.
+void link_pages(
+	page_result& page,
+	const std::vector<std::int64_t>& page_keys,
+	const std::vector<std::int64_t>& before,
+	const std::vector<std::int64_t>& after);
+
+// page `page_id` (from 1) of `query` ordered by its integer column
+// `key`, converted with `orm`. pages reached through a cursor of
+// the request are read with `key > ?` (or `key < ?`), which costs
+// the same on any page, a page number without a cursor uses offset.
+// the page is read with the keys of the pages around it, which give
+// the cursors of their links, and the rows are not counted unless
+// the last page is out of reach of these.
+// `query` must not end with `;` or have its own order or limit.
+template <typename ...Params>
+page_result paginate(
+	bserv::db_transaction& tx,
+	const bserv::db_relation_to_object& orm,
+	const bserv::request_type& request,
+	const std::string& query,
+	const std::string& key,
+	int page_id,
+	const Params&... params) {
+	std::optional<page_cursor> cursor = request_cursor(request);
+	const std::string rows_query = "select page_.* from (" + query + ") as page_";
+	const std::string keys_query = "select page_." + key + " from (" + query + ") as page_";
+	const std::string order = " order by page_." + key;
+	// one row more than the pages after the window tells if there
+	// are more
+	const int rows_after = (page_window + 1) * page_size + 1;
+	const int rows_before = page_window * page_size;
+	bool backwards = cursor && cursor->from != page_cursor::direction::after;
+	// the page, followed by the rows after it, or before it when read
+	// backwards
+	bserv::db_result db_res = [&]() {
+		if (!cursor)
+			return tx.exec(rows_query + order + " limit ? offset ?;",
+				params..., page_size + rows_after, (page_id - 1) * page_size);
+		switch (cursor->from) {
+		case page_cursor::direction::after:
+			return tx.exec(rows_query + " where page_." + key + " > ?" + order + " limit ?;",
+				params..., cursor->key, page_size + rows_after);
+		case page_cursor::direction::before:
+			return tx.exec(rows_query + " where page_." + key + " < ?" + order + " desc limit ?;",
+				params..., cursor->key, page_size + rows_before);
+		default:
+			return tx.exec(rows_query + order + " desc limit ?;",
+				params..., (int)cursor->key + rows_before);
+		}
+	}();
+	lginfo << db_res.query();
+	std::size_t page_rows = cursor && cursor->from == page_cursor::direction::last
+		? (std::size_t)cursor->key : (std::size_t)page_size;
+	page_result result;
+	std::vector<std::int64_t> page_keys, before, after;
+	for (auto row = db_res.begin(); row != db_res.end(); ++row) {
+		std::int64_t value = (*row)[key.c_str()].as<std::int64_t>();
+		if (page_keys.size() < page_rows) {
+			result.rows.push_back(orm.convert_row(*row));
+			page_keys.push_back(value);
+		}
+		else {
+			(backwards ? before : after).push_back(value);
+		}
+	}
+	if (backwards) {
+		std::reverse(result.rows.begin(), result.rows.end());
+		std::reverse(page_keys.begin(), page_keys.end());
+	}
+	// the keys on the other side
+	if (!page_keys.empty() && cursor && cursor->from == page_cursor::direction::before) {
+		bserv::db_result keys = tx.exec(keys_query + " where page_." + key + " > ?" + order + " limit ?;",
+			params..., page_keys.back(), rows_after);
+		lginfo << keys.query();
+		for (auto row = keys.begin(); row != keys.end(); ++row)
+			after.push_back((*row)[0].as<std::int64_t>());
+	}
+	else if (!page_keys.empty() && !backwards && page_id > 1) {
+		bserv::db_result keys = tx.exec(keys_query + " where page_." + key + " < ?" + order + " desc limit ?;",
+			params..., page_keys.front(), rows_before);
+		lginfo << keys.query();
+		for (auto row = keys.begin(); row != keys.end(); ++row)
+			before.push_back((*row)[0].as<std::int64_t>());
+	}
+	link_pages(result, page_keys, before, after);
+	if (after.size() >= (std::size_t)rows_after || (page_keys.empty() && (page_id > 1 || cursor))) {
+		std::size_t count = row_count(tx, query, params...);
+		result.total_pages = (count + page_size - 1) / page_size;
+		if (count > 0)
+			result.last_cursor = encode_cursor({ page_cursor::direction::last,
+				(std::int64_t)((count - 1) % page_size + 1) });
+	}
+	return result;
+}
+
+// sets `context["pagination"]` for page `page_id` of `page`, as the
+// page templates expect it. nothing is set without rows.
+void set_pagination(boost::json::object& context, int page_id, const page_result& page);
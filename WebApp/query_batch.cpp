@@ -0,0 +1,51 @@
+#include "query_batch.h"
+
+#include "metrics.h"
+
+namespace {
+
+	metric_counter& batch_queries_ = get_counter("sql.batch.queries");
+	metric_counter& batch_round_trips_ = get_counter("sql.batch.round_trips");
+
+} // namespace
+
+query_batch::query_batch(pqxx::transaction_base& tx, std::shared_ptr<bserv::db_connection> conn)
+	: tx_{ tx }, conn_{ conn } {}
+
+pqxx::pipeline::query_id query_batch::insert(
+	const std::string& sql,
+	std::initializer_list<std::string> params) {
+	std::string query;
+	auto param = params.begin();
+	for (char c : sql) {
+		if (c == '?' && param != params.end())
+			query += *param++;
+		else
+			query += c;
+	}
+	lginfo << query;
+	batch_queries_.add();
+	if (!pipeline_) {
+		pipeline_.emplace(tx_);
+		// hold every query back until a result is needed
+		pipeline_->retain(1024);
+	}
+	return pipeline_->insert(query);
+}
+
+pqxx::result query_batch::get(pqxx::pipeline::query_id query) {
+	if (!sent_) {
+		batch_round_trips_.add();
+		sent_ = true;
+	}
+	return pipeline_->retrieve(query);
+}
+
+boost::json::array convert_to_array(
+	const bserv::db_relation_to_object& orm,
+	const pqxx::result& result) {
+	boost::json::array array;
+	for (const auto& row : result)
+		array.push_back(orm.convert_row(row));
+	return array;
+}
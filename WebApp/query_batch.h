@@ -0,0 +1,48 @@
+#pragma once
+
+#include <string>
+#include <memory>
+#include <optional>
+
+#include <pqxx/pqxx>
+#include <boost/json.hpp>
+#include "bserv/common.hpp"
+#include "statements.h"
+
+// registered statements that are sent to postgres together, with
+// pqxx::pipeline, and answered in one round trip. for pages that
+// run several queries which do not depend on each other.
+class query_batch {
+public:
+	// `tx` is a transaction on `conn`, and must outlive the batch.
+	query_batch(pqxx::transaction_base& tx, std::shared_ptr<bserv::db_connection> conn);
+
+	// queues the statement registered as `name`. nothing is sent
+	// until the first result is asked for.
+	template <typename ...Params>
+	pqxx::pipeline::query_id add(const std::string& name, const Params&... params) {
+		const prepared_statement& statement = get_statement(tx_, conn_->get(), name);
+		statement.calls->add();
+		return insert(statement.execute, { tx_.quote(params)... });
+	}
+
+	// the result of `query`. the first call sends every queued query.
+	pqxx::result get(pqxx::pipeline::query_id query);
+
+private:
+	pqxx::pipeline::query_id insert(
+		const std::string& sql,
+		std::initializer_list<std::string> params);
+
+	pqxx::transaction_base& tx_;
+	std::shared_ptr<bserv::db_connection> conn_;
+	// opened with the first query. the transaction cannot run
+	// anything else then, such as preparing the statements.
+	std::optional<pqxx::pipeline> pipeline_;
+	bool sent_ = false;
+};
+
+// `orm.convert_to_vector` for a result of a batch.
+boost::json::array convert_to_array(
+	const bserv::db_relation_to_object& orm,
+	const pqxx::result& result);
@@ -0,0 +1,230 @@
+#include "read_pool.h"
+
+#include <array>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <exception>
+#include <stdexcept>
+
+#include "metrics.h"
+#include "statements.h"
+
+namespace {
+
+	using clock = std::chrono::steady_clock;
+
+	// the pool grows while the 95th percentile of recent waits is
+	// above `grow_wait`, and closes a connection idle for `idle_time`
+	// while it is below `shrink_wait`.
+	constexpr std::chrono::microseconds grow_wait{ 2000 };
+	constexpr std::chrono::microseconds shrink_wait{ 100 };
+	constexpr std::chrono::seconds idle_time{ 30 };
+
+	// each connection has a manager of its own, so that connections
+	// can be opened in parallel and closed one at a time, which
+	// db_connection_manager does not do for the ones it holds.
+	struct pooled_connection {
+		std::shared_ptr<bserv::db_connection_manager> manager;
+		clock::time_point idle_since;
+	};
+
+	metric_counter& acquire_calls_ = get_counter("read_pool.acquire.calls");
+	metric_counter& acquire_wait_ns_ = get_counter("read_pool.acquire.wait_ns");
+	metric_counter& hold_ns_ = get_counter("read_pool.hold_ns");
+	metric_counter& errors_ = get_counter("read_pool.errors");
+	metric_counter& grown_ = get_counter("read_pool.grown");
+	metric_counter& shrunk_ = get_counter("read_pool.shrunk");
+
+	std::string conn_str_;
+	int min_conn_;
+	int max_conn_;
+
+	std::mutex pool_mutex_;
+	std::condition_variable pool_cv_;
+	std::vector<pooled_connection> idle_;
+	// idle, in use and being opened
+	int open_ = 0;
+	int in_use_ = 0;
+	// the last waits, in microseconds
+	std::array<std::uint32_t, 256> waits_{};
+	std::size_t wait_count_ = 0;
+
+	// call with pool_mutex_ held.
+	std::chrono::microseconds wait_p95() {
+		std::size_t n = std::min(wait_count_, waits_.size());
+		if (n == 0)
+			return std::chrono::microseconds{ 0 };
+		std::array<std::uint32_t, 256> waits = waits_;
+		auto p95 = waits.begin() + (n * 95 / 100);
+		std::nth_element(waits.begin(), p95, waits.begin() + n);
+		return std::chrono::microseconds{ *p95 };
+	}
+
+	// the connection is read only for its whole session, so its
+	// transactions do not each need a statement to say so, and has
+	// the registered statements prepared before a request gets it.
+	std::shared_ptr<bserv::db_connection_manager> open_connection() {
+		try {
+			auto manager = std::make_shared<bserv::db_connection_manager>(conn_str_, 1);
+			std::shared_ptr<bserv::db_connection> conn = manager->get_or_block();
+			{
+				pqxx::nontransaction tx{ conn->get() };
+				tx.exec0("set default_transaction_read_only = on;");
+			}
+			prepare_statements(conn->get());
+			return manager;
+		}
+		catch (...) {
+			errors_.add();
+			throw;
+		}
+	}
+
+	void release(std::shared_ptr<bserv::db_connection_manager> manager, clock::time_point acquired) {
+		auto now = clock::now();
+		hold_ns_.add((std::uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(now - acquired).count());
+		std::shared_ptr<bserv::db_connection_manager> closed;
+		{
+			std::lock_guard<std::mutex> lock{ pool_mutex_ };
+			--in_use_;
+			idle_.push_back({ std::move(manager), now });
+			if (open_ > min_conn_ && idle_.size() > 1 && wait_p95() < shrink_wait
+				&& now - idle_.front().idle_since > idle_time) {
+				// the front is the connection idle the longest
+				closed = std::move(idle_.front().manager);
+				idle_.erase(idle_.begin());
+				--open_;
+				shrunk_.add();
+			}
+		}
+		pool_cv_.notify_one();
+		// closed outside the lock. the statements prepared on it go
+		// first, a connection opened later may get its address.
+		if (closed != nullptr)
+			forget_statements(closed->get_or_block()->get());
+	}
+
+	std::shared_ptr<bserv::db_connection> acquire() {
+		auto start = clock::now();
+		std::unique_lock<std::mutex> lock{ pool_mutex_ };
+		for (;;) {
+			while (idle_.empty()) {
+				if (open_ < max_conn_ && wait_p95() > grow_wait) {
+					++open_;
+					grown_.add();
+					lock.unlock();
+					std::shared_ptr<bserv::db_connection_manager> manager;
+					try {
+						manager = open_connection();
+					}
+					catch (...) {
+						lock.lock();
+						--open_;
+						throw;
+					}
+					lock.lock();
+					idle_.push_back({ std::move(manager), clock::now() });
+					break;
+				}
+				pool_cv_.wait(lock);
+			}
+			std::shared_ptr<bserv::db_connection_manager> manager = std::move(idle_.back().manager);
+			idle_.pop_back();
+			++in_use_;
+			auto acquired = clock::now();
+			auto wait = std::chrono::duration_cast<std::chrono::microseconds>(acquired - start);
+			waits_[wait_count_++ % waits_.size()] = (std::uint32_t)std::min<long long>(wait.count(), UINT32_MAX);
+			lock.unlock();
+			acquire_calls_.add();
+			acquire_wait_ns_.add((std::uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(acquired - start).count());
+
+			std::shared_ptr<bserv::db_connection> conn = manager->get_or_block();
+			if (conn->get().is_open()) {
+				// returned to its manager, then the manager to the pool
+				return std::shared_ptr<bserv::db_connection>(conn.get(),
+					[conn, manager, acquired](bserv::db_connection*) mutable {
+						conn.reset();
+						release(std::move(manager), acquired);
+					});
+			}
+			// the server closed it, open another one in its place
+			errors_.add();
+			forget_statements(conn->get());
+			conn.reset();
+			manager.reset();
+			std::shared_ptr<bserv::db_connection_manager> replacement;
+			try {
+				replacement = open_connection();
+			}
+			catch (...) {
+				lock.lock();
+				--in_use_;
+				--open_;
+				lock.unlock();
+				pool_cv_.notify_one();
+				throw;
+			}
+			lock.lock();
+			--in_use_;
+			idle_.push_back({ std::move(replacement), clock::now() });
+		}
+	}
+
+} // namespace
+
+void init_read_pool(const std::string& conn_str, int min_conn, int max_conn) {
+	conn_str_ = conn_str;
+	min_conn_ = std::max(min_conn, 1);
+	max_conn_ = std::max(max_conn, min_conn_);
+
+	// connect in parallel rather than one after another
+	std::vector<std::shared_ptr<bserv::db_connection_manager>> managers(min_conn_);
+	std::vector<std::exception_ptr> errors(min_conn_);
+	std::vector<std::thread> threads;
+	for (int i = 0; i < min_conn_; ++i)
+		threads.emplace_back([&, i] {
+			try {
+				managers[i] = open_connection();
+			}
+			catch (...) {
+				errors[i] = std::current_exception();
+			}
+		});
+	for (auto& thread : threads)
+		thread.join();
+	for (const auto& error : errors)
+		if (error)
+			std::rethrow_exception(error);
+	{
+		std::lock_guard<std::mutex> lock{ pool_mutex_ };
+		for (auto& manager : managers)
+			idle_.push_back({ std::move(manager), clock::now() });
+		open_ = min_conn_;
+	}
+
+	register_gauge("read_pool.open", [] {
+		std::lock_guard<std::mutex> lock{ pool_mutex_ };
+		return (double)open_;
+	});
+	register_gauge("read_pool.in_use", [] {
+		std::lock_guard<std::mutex> lock{ pool_mutex_ };
+		return (double)in_use_;
+	});
+	register_gauge("read_pool.wait_p95_us", [] {
+		std::lock_guard<std::mutex> lock{ pool_mutex_ };
+		return (double)wait_p95().count();
+	});
+}
+
+std::shared_ptr<bserv::db_connection> read_connection() {
+	if (max_conn_ == 0)
+		throw std::logic_error{ "the read pool is not initialized" };
+	return acquire();
+}
+
+db_read_transaction::db_read_transaction(std::shared_ptr<bserv::db_connection> conn)
+	: bserv::db_transaction{ conn } {}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <string>
+#include <memory>
+
+#include "bserv/common.hpp"
+
+// opens the pool the read only pages take their connections from,
+// `min_conn` connections to `conn_str`, opened in parallel. the
+// server can then point reads at a replica, or at the primary, where
+// the read pool keeps reads from holding every connection writes need.
+// with `max_conn` above `min_conn` the pool opens more connections
+// while requests wait for one, and closes them again once idle.
+// the registered statements (statements.h) are prepared on each
+// connection as it is opened. the pool reports `read_pool.*` metrics.
+void init_read_pool(const std::string& conn_str, int min_conn, int max_conn);
+
+// a connection of the read pool, blocks while none is free.
+std::shared_ptr<bserv::db_connection> read_connection();
+
+// a transaction that postgres refuses to write in, safe to run
+// on a replica. the read pool's connections default to read only
+// transactions, so it costs no extra round trip.
+class db_read_transaction : public bserv::db_transaction {
+public:
+	explicit db_read_transaction(std::shared_ptr<bserv::db_connection> conn);
+};
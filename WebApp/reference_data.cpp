@@ -0,0 +1,508 @@
+#include "reference_data.h"
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <map>
+#include <bitset>
+#include <algorithm>
+#include <thread>
+#include <exception>
+#include <stdexcept>
+
+#include "metrics.h"
+#include "read_pool.h"
+
+namespace {
+
+	metric_counter& hits_ = get_counter("reference_data.hits");
+	metric_counter& loads_ = get_counter("reference_data.loads");
+	metric_counter& patches_ = get_counter("reference_data.patches");
+	metric_counter& drifts_ = get_counter("reference_data.drifts");
+
+	reference_loader load_ = nullptr;
+	dish_loader load_dish_ = nullptr;
+	// behind load_mutex_
+	std::vector<reference_listener> listeners_;
+
+	// the version of the latest snapshot, ahead of it only while a
+	// reload after a write failed.
+	std::atomic<std::uint64_t> version_{ 0 };
+
+	// the latest snapshot, written with both mutexes held and read
+	// with either. load_mutex_ is held while loading, so there is one
+	// load at a time, snapshot_mutex_ only to copy the pointer.
+	std::mutex load_mutex_;
+	std::mutex snapshot_mutex_;
+	std::shared_ptr<const reference_data> snapshot_;
+
+	// each thread keeps a copy of the pointer, so the hot path does
+	// not touch a mutex.
+	thread_local std::shared_ptr<const reference_data> thread_snapshot_;
+
+	// call with load_mutex_ held. readers see the new version once
+	// the snapshot is in place. `dish` as for the listeners.
+	void publish(reference_data&& data, std::uint64_t version, const int* dish = nullptr) {
+		data.version = version;
+		auto snapshot = std::make_shared<const reference_data>(std::move(data));
+		{
+			std::lock_guard<std::mutex> lock{ snapshot_mutex_ };
+			snapshot_ = std::move(snapshot);
+		}
+		version_.store(version, std::memory_order_release);
+		(dish == nullptr ? loads_ : patches_).add();
+		for (reference_listener listener : listeners_)
+			listener(*snapshot_, dish);
+	}
+
+	// the positions of a patched snapshot differ from those of a load,
+	// so dishes are compared in D_ order, without the deleted ones.
+	bool same_dishes(
+		const std::vector<std::shared_ptr<const menu_dish>>& a,
+		const std::vector<std::shared_ptr<const menu_dish>>& b) {
+		auto i = a.begin();
+		auto j = b.begin();
+		for (;; ++i, ++j) {
+			i = std::find_if(i, a.end(), [](const auto& dish) { return dish != nullptr; });
+			j = std::find_if(j, b.end(), [](const auto& dish) { return dish != nullptr; });
+			if (i == a.end() || j == b.end())
+				return i == a.end() && j == b.end();
+			if ((*i)->json != (*j)->json)
+				return false;
+		}
+	}
+
+	// the D_ of the dishes of each tag, by T_.
+	std::map<int, std::vector<int>> tag_dish_ids(const reference_data& data) {
+		std::map<int, std::vector<int>> result;
+		for (const auto& tag : data.tag_dishes)
+			for (std::uint32_t i : tag.second.positions())
+				result[tag.first].push_back(data.dishes[i]->id);
+		return result;
+	}
+
+	bool same_data(const reference_data& a, const reference_data& b) {
+		return a.canteens == b.canteens
+			&& a.all_tags == b.all_tags
+			&& a.windows == b.windows
+			&& a.tags == b.tags
+			&& same_dishes(a.dishes, b.dishes)
+			&& tag_dish_ids(a) == tag_dish_ids(b);
+	}
+
+	// those of data.all_tags that have dishes in `dishes`, with their
+	// count.
+	boost::json::array tags_in(const reference_data& data, const dish_bitmap& dishes) {
+		boost::json::array result;
+		for (const auto& tag : data.all_tags) {
+			auto it = data.tag_dishes.find((int)tag.as_object().at("T_").as_int64());
+			std::size_t n = it == data.tag_dishes.end() ? 0 : dishes.count_and(it->second);
+			if (n == 0)
+				continue;
+			boost::json::object obj = tag.as_object();
+			obj["count"] = n;
+			result.push_back(std::move(obj));
+		}
+		return result;
+	}
+
+	// counts the tags of `canteen` and `window` again after a patch.
+	// a canteen or window left without dishes has no bitmap and no
+	// tags, as after a load.
+	void count_tags(reference_data& data, int canteen, int window) {
+		auto dishes = data.canteen_dishes.find(canteen);
+		if (dishes != data.canteen_dishes.end() && dishes->second.count() == 0)
+			dishes = data.canteen_dishes.erase(dishes);
+		if (dishes == data.canteen_dishes.end())
+			data.tags.erase(canteen);
+		else
+			data.tags[canteen] = tags_in(data, dishes->second);
+		dishes = data.window_dishes.find(window);
+		if (dishes != data.window_dishes.end() && dishes->second.count() == 0)
+			dishes = data.window_dishes.erase(dishes);
+		auto windows = data.windows.find(canteen);
+		if (windows == data.windows.end())
+			return;
+		for (auto& obj : windows->second)
+			if (obj.as_object().at("W_").as_int64() == window)
+				obj.as_object()["tags"] = dishes == data.window_dishes.end()
+					? boost::json::array{} : tags_in(data, dishes->second);
+	}
+
+	// a copy of `old` with the dish `id` replaced by `update`, or
+	// deleted without one. nullopt if a new dish would not sort last,
+	// then the snapshot is loaded instead.
+	std::optional<reference_data> patch_dish(
+		const reference_data& old,
+		int id,
+		const std::optional<dish_update>& update) {
+		// the dishes themselves are shared with `old`
+		reference_data data = old;
+		std::vector<std::pair<int, int>> touched;
+		std::uint32_t position;
+		auto it = data.positions.find(id);
+		if (it != data.positions.end()) {
+			position = it->second;
+			const menu_dish& dish = *data.dishes[position];
+			touched.emplace_back(dish.canteen, dish.window);
+			data.canteen_dishes[dish.canteen].reset(position);
+			data.window_dishes[dish.window].reset(position);
+			for (auto& tag : data.tag_dishes)
+				tag.second.reset(position);
+			std::pair<std::string, std::uint32_t> name{ normalize_name(dish.name), position };
+			auto n = std::lower_bound(data.names.begin(), data.names.end(), name);
+			if (n != data.names.end() && *n == name)
+				data.names.erase(n);
+			if (!update.has_value()) {
+				data.dishes[position] = nullptr;
+				data.positions.erase(it);
+			}
+		}
+		else {
+			if (!update.has_value())
+				return data;
+			// D_ comes from a sequence, a new dish is the last one
+			auto last = std::find_if(data.dishes.rbegin(), data.dishes.rend(),
+				[](const auto& dish) { return dish != nullptr; });
+			if (last != data.dishes.rend() && (*last)->id > id)
+				return std::nullopt;
+			position = (std::uint32_t)data.dishes.size();
+			data.dishes.push_back(nullptr);
+			data.positions[id] = position;
+		}
+		if (update.has_value()) {
+			const menu_dish& dish = update->dish;
+			touched.emplace_back(dish.canteen, dish.window);
+			data.canteen_dishes[dish.canteen].set(position);
+			data.window_dishes[dish.window].set(position);
+			for (int tag : update->tags)
+				data.tag_dishes[tag].set(position);
+			std::pair<std::string, std::uint32_t> name{ normalize_name(dish.name), position };
+			data.names.insert(std::upper_bound(data.names.begin(), data.names.end(), name), std::move(name));
+			data.dishes[position] = std::make_shared<const menu_dish>(dish);
+		}
+		for (const auto& [canteen, window] : touched)
+			count_tags(data, canteen, window);
+		return data;
+	}
+
+	void start_reference_check(int interval) {
+		std::thread{ [interval]() {
+			while (true) {
+				std::this_thread::sleep_for(std::chrono::seconds{ interval });
+				try {
+					auto conn = read_connection();
+					std::uint64_t version = version_.load(std::memory_order_acquire);
+					reference_data data = load_(conn);
+					conn.reset();
+					std::lock_guard<std::mutex> lock{ load_mutex_ };
+					// a write published a newer snapshot meanwhile
+					if (version_.load(std::memory_order_acquire) != version
+						|| snapshot_ == nullptr || snapshot_->version < version)
+						continue;
+					if (same_data(*snapshot_, data))
+						continue;
+					drifts_.add();
+					lgwarning << "reference data differs from the database, reloaded" << std::endl;
+					publish(std::move(data), version + 1);
+				}
+				catch (const std::exception& e) {
+					lgerror << "reference data check failed: " << e.what() << std::endl;
+				}
+			}
+		} }.detach();
+	}
+
+	// the published snapshot if it is current, nullptr after a failed
+	// reload. the version is read first: a snapshot published since
+	// then is newer, never older.
+	std::shared_ptr<const reference_data> published_snapshot() {
+		std::uint64_t version = version_.load(std::memory_order_acquire);
+		if (thread_snapshot_ == nullptr || thread_snapshot_->version < version) {
+			std::shared_ptr<const reference_data> snapshot;
+			{
+				std::lock_guard<std::mutex> lock{ snapshot_mutex_ };
+				snapshot = snapshot_;
+			}
+			if (snapshot == nullptr || snapshot->version < version)
+				return nullptr;
+			thread_snapshot_ = std::move(snapshot);
+		}
+		hits_.add();
+		return thread_snapshot_;
+	}
+
+	// loads the snapshot through the connection `connect` returns,
+	// unless another thread has while this one waited for the lock.
+	template <typename Connect>
+	std::shared_ptr<const reference_data> load_snapshot(Connect connect) {
+		if (load_ == nullptr)
+			throw std::logic_error{ "the reference data is not initialized" };
+		std::lock_guard<std::mutex> lock{ load_mutex_ };
+		std::uint64_t version = version_.load(std::memory_order_acquire);
+		if (snapshot_ == nullptr || snapshot_->version < version)
+			publish(load_(connect()), version);
+		else
+			hits_.add();
+		thread_snapshot_ = snapshot_;
+		return thread_snapshot_;
+	}
+
+	// calls `f` with the position of each dish whose normalized name
+	// starts with `prefix`, in name order, while it returns true.
+	template <typename F>
+	void for_each_prefixed(const reference_data& data, const std::string& prefix, F f) {
+		std::string key = normalize_name(prefix);
+		// the names starting with `key` sort together, from the first
+		// one not less than it
+		auto it = std::lower_bound(data.names.begin(), data.names.end(), key,
+			[](const std::pair<std::string, std::uint32_t>& name, const std::string& key) {
+				return name.first < key;
+			});
+		for (; it != data.names.end() && it->first.compare(0, key.size(), key) == 0; ++it)
+			if (!f(it->second))
+				break;
+	}
+
+} // namespace
+
+dish_bitmap::dish_bitmap(std::size_t size)
+	: words_((size + 63) / 64) {}
+
+void dish_bitmap::set(std::uint32_t position) {
+	if (position / 64 >= words_.size())
+		words_.resize(position / 64 + 1);
+	words_[position / 64] |= std::uint64_t{ 1 } << (position % 64);
+}
+
+void dish_bitmap::reset(std::uint32_t position) {
+	if (position / 64 < words_.size())
+		words_[position / 64] &= ~(std::uint64_t{ 1 } << (position % 64));
+}
+
+std::size_t dish_bitmap::count() const {
+	std::size_t n = 0;
+	for (std::uint64_t word : words_)
+		n += std::bitset<64>{ word }.count();
+	return n;
+}
+
+std::size_t dish_bitmap::count_and(const dish_bitmap& other) const {
+	std::size_t size = std::min(words_.size(), other.words_.size());
+	std::size_t n = 0;
+	for (std::size_t i = 0; i < size; ++i)
+		n += std::bitset<64>{ words_[i] & other.words_[i] }.count();
+	return n;
+}
+
+dish_bitmap& dish_bitmap::operator&=(const dish_bitmap& other) {
+	std::size_t size = std::min(words_.size(), other.words_.size());
+	for (std::size_t i = 0; i < size; ++i)
+		words_[i] &= other.words_[i];
+	std::fill(words_.begin() + size, words_.end(), 0);
+	return *this;
+}
+
+dish_bitmap& dish_bitmap::operator|=(const dish_bitmap& other) {
+	if (words_.size() < other.words_.size())
+		words_.resize(other.words_.size());
+	for (std::size_t i = 0; i < other.words_.size(); ++i)
+		words_[i] |= other.words_[i];
+	return *this;
+}
+
+bool dish_bitmap::operator==(const dish_bitmap& other) const {
+	return words_ == other.words_;
+}
+
+std::vector<std::uint32_t> dish_bitmap::positions() const {
+	std::vector<std::uint32_t> result;
+	for (std::size_t i = 0; i < words_.size(); ++i)
+		for (std::uint64_t word = words_[i]; word != 0; word &= word - 1) {
+			// the lowest set bit, counted by the ones below it
+			std::uint64_t below = (word & (~word + 1)) - 1;
+			result.push_back((std::uint32_t)(i * 64 + std::bitset<64>{ below }.count()));
+		}
+	return result;
+}
+
+void index_menu(reference_data& data, boost::json::array all_tags) {
+	for (std::uint32_t i = 0; i < data.dishes.size(); ++i) {
+		data.canteen_dishes.try_emplace(data.dishes[i]->canteen, data.dishes.size()).first->second.set(i);
+		data.window_dishes.try_emplace(data.dishes[i]->window, data.dishes.size()).first->second.set(i);
+		data.names.emplace_back(normalize_name(data.dishes[i]->name), i);
+	}
+	std::sort(data.names.begin(), data.names.end());
+	data.all_tags = std::move(all_tags);
+	for (const auto& canteen : data.canteen_dishes)
+		data.tags[canteen.first] = tags_in(data, canteen.second);
+	for (auto& windows : data.windows)
+		for (auto& window : windows.second) {
+			auto it = data.window_dishes.find((int)window.as_object().at("W_").as_int64());
+			window.as_object()["tags"] = it == data.window_dishes.end()
+				? boost::json::array{} : tags_in(data, it->second);
+		}
+}
+
+void init_reference_data(
+	const std::shared_ptr<bserv::db_connection>& conn,
+	reference_loader load,
+	dish_loader load_dish,
+	int check_interval) {
+	load_ = load;
+	load_dish_ = load_dish;
+	{
+		std::lock_guard<std::mutex> lock{ load_mutex_ };
+		publish(load_(conn), 1);
+	}
+	if (check_interval > 0)
+		start_reference_check(check_interval);
+}
+
+std::shared_ptr<const reference_data> reference_snapshot() {
+	if (auto data = published_snapshot())
+		return data;
+	return load_snapshot([] { return read_connection(); });
+}
+
+std::shared_ptr<const reference_data> get_reference_data(
+	const std::shared_ptr<bserv::db_connection>& conn) {
+	if (auto data = published_snapshot())
+		return data;
+	return load_snapshot([&conn] { return conn; });
+}
+
+void reload_reference_data(const std::shared_ptr<bserv::db_connection>& conn) {
+	std::lock_guard<std::mutex> lock{ load_mutex_ };
+	std::uint64_t version = version_.load(std::memory_order_acquire) + 1;
+	try {
+		publish(load_(conn), version);
+	}
+	catch (const std::exception& e) {
+		lgerror << "reference data reload failed: " << e.what() << std::endl;
+		// the old snapshot is no longer current, readers load it
+		version_.store(version, std::memory_order_release);
+	}
+}
+
+void reload_dish(const std::shared_ptr<bserv::db_connection>& conn, int id) {
+	std::lock_guard<std::mutex> lock{ load_mutex_ };
+	std::uint64_t version = version_.load(std::memory_order_acquire) + 1;
+	try {
+		std::optional<reference_data> data;
+		// behind a failed reload the snapshot is loaded in full
+		if (snapshot_ != nullptr && snapshot_->version + 1 == version)
+			data = patch_dish(*snapshot_, id, load_dish_(conn, id));
+		if (data.has_value())
+			publish(std::move(*data), version, &id);
+		else
+			publish(load_(conn), version);
+	}
+	catch (const std::exception& e) {
+		lgerror << "reference data reload failed: " << e.what() << std::endl;
+		version_.store(version, std::memory_order_release);
+	}
+}
+
+void on_reference_data(reference_listener listener) {
+	std::lock_guard<std::mutex> lock{ load_mutex_ };
+	listeners_.push_back(listener);
+}
+
+const boost::json::array& find_or_empty(
+	const std::unordered_map<int, boost::json::array>& map,
+	int id) {
+	static const boost::json::array empty;
+	auto it = map.find(id);
+	return it == map.end() ? empty : it->second;
+}
+
+std::string normalize_name(const std::string& name) {
+	std::string result;
+	result.reserve(name.size());
+	for (std::size_t i = 0; i < name.size();) {
+		unsigned char c = name[i];
+		std::size_t length = c < 0x80 ? 1 : (c >> 5) == 0x6 ? 2 : (c >> 4) == 0xe ? 3 : (c >> 3) == 0x1e ? 4 : 1;
+		if (i + length > name.size())
+			break;
+		if (length == 1) {
+			result += (char)(c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c);
+		}
+		else if (length == 3) {
+			char32_t code = (char32_t)(c & 0x0f) << 12
+				| (char32_t)(name[i + 1] & 0x3f) << 6
+				| (char32_t)(name[i + 2] & 0x3f);
+			if (code >= 0xff01 && code <= 0xff5e) {
+				char ascii = (char)(code - 0xff01 + 0x21);
+				result += ascii >= 'A' && ascii <= 'Z' ? (char)(ascii - 'A' + 'a') : ascii;
+			}
+			else if (code == 0x3000) {
+				result += ' ';
+			}
+			else {
+				result.append(name, i, length);
+			}
+		}
+		else {
+			result.append(name, i, length);
+		}
+		i += length;
+	}
+	return result;
+}
+
+dish_bitmap find_dishes_by_prefix(const reference_data& data, const std::string& prefix) {
+	dish_bitmap result{ data.dishes.size() };
+	for_each_prefixed(data, prefix, [&](std::uint32_t position) {
+		result.set(position);
+		return true;
+	});
+	return result;
+}
+
+std::vector<std::uint32_t> first_dishes_by_prefix(
+	const reference_data& data,
+	const std::string& prefix,
+	std::size_t limit) {
+	std::vector<std::uint32_t> result;
+	if (limit == 0)
+		return result;
+	for_each_prefixed(data, prefix, [&](std::uint32_t position) {
+		result.push_back(position);
+		return result.size() < limit;
+	});
+	return result;
+}
+
+boost::json::array find_menu_dishes(
+	const reference_data& data,
+	int canteen,
+	int window,
+	const std::vector<int>& tags,
+	bool match_all,
+	const std::string& prefix) {
+	static const dish_bitmap empty;
+	auto find = [](const std::unordered_map<int, dish_bitmap>& map, int id) -> const dish_bitmap& {
+		auto it = map.find(id);
+		return it == map.end() ? empty : it->second;
+	};
+	dish_bitmap dishes = find(data.canteen_dishes, canteen);
+	if (window != 0)
+		dishes &= find(data.window_dishes, window);
+	if (match_all) {
+		for (int tag : tags)
+			dishes &= find(data.tag_dishes, tag);
+	}
+	else if (!tags.empty()) {
+		dish_bitmap any;
+		for (int tag : tags)
+			any |= find(data.tag_dishes, tag);
+		dishes &= any;
+	}
+	if (!prefix.empty())
+		dishes &= find_dishes_by_prefix(data, prefix);
+	boost::json::array result;
+	for (std::uint32_t i : dishes.positions())
+		result.push_back(data.dishes[i]->json);
+	return result;
+}
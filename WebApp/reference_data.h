@@ -0,0 +1,170 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <optional>
+#include <unordered_map>
+
+#include <boost/json.hpp>
+#include "bserv/common.hpp"
+
+// a set of positions in reference_data::dishes, one bit each. the
+// positions are dense, so plain 64 bit words do better than a
+// compressed bitmap, and the loops over them vectorize.
+class dish_bitmap {
+public:
+	dish_bitmap() = default;
+	explicit dish_bitmap(std::size_t size);
+	// grows the bitmap if `position` is past its size.
+	void set(std::uint32_t position);
+	void reset(std::uint32_t position);
+	std::size_t count() const;
+	// the size of the intersection, without building it.
+	std::size_t count_and(const dish_bitmap& other) const;
+	dish_bitmap& operator&=(const dish_bitmap& other);
+	dish_bitmap& operator|=(const dish_bitmap& other);
+	bool operator==(const dish_bitmap& other) const;
+	// the positions in the set, ascending.
+	std::vector<std::uint32_t> positions() const;
+private:
+	std::vector<std::uint64_t> words_;
+};
+
+// a dish of the menu, with the window and canteen it is sold at.
+struct menu_dish {
+	int id = 0;
+	int window = 0;
+	int canteen = 0;
+	std::string name;
+	// the row as orm_dish converts it.
+	boost::json::object json;
+};
+
+// the canteens, windows, tags and dishes of the menu, which change
+// a few times a semester but are read by every menu page. a snapshot
+// is never modified after it is published. a write to a single dish
+// publishes a patched copy, which shares the other dishes.
+struct reference_data {
+	std::uint64_t version = 0;
+	boost::json::array canteens;
+	// every tag, in T_ order.
+	boost::json::array all_tags;
+	// the windows of each canteen, by C_, each with the `tags` of its
+	// dishes and their dish `count`.
+	std::unordered_map<int, boost::json::array> windows;
+	// the tags of the dishes of each canteen, by C_, with their
+	// dish `count`.
+	std::unordered_map<int, boost::json::array> tags;
+	// every dish, in D_ order. a dish deleted since the last load
+	// leaves a nullptr, so the positions of the others stay valid.
+	std::vector<std::shared_ptr<const menu_dish>> dishes;
+	// the position in `dishes` of each D_.
+	std::unordered_map<int, std::uint32_t> positions;
+	// the dishes of each canteen (by C_), window (by W_) and tag
+	// (by T_).
+	std::unordered_map<int, dish_bitmap> canteen_dishes;
+	std::unordered_map<int, dish_bitmap> window_dishes;
+	std::unordered_map<int, dish_bitmap> tag_dishes;
+	// the normalized names of `dishes` with their positions, sorted,
+	// for name prefix search.
+	std::vector<std::pair<std::string, std::uint32_t>> names;
+};
+
+// a dish as a write left it, with the T_ of its tags.
+struct dish_update {
+	menu_dish dish;
+	std::vector<int> tags;
+};
+
+// loads a snapshot through `conn`.
+using reference_loader = reference_data (*)(const std::shared_ptr<bserv::db_connection>& conn);
+
+// loads the dish `id` through `conn`, nullopt if there is none.
+using dish_loader = std::optional<dish_update> (*)(
+	const std::shared_ptr<bserv::db_connection>& conn,
+	int id);
+
+// called with each snapshot as it is published, one at a time.
+// `dish` is the D_ of the only dish that changed, nullptr if any
+// may have.
+using reference_listener = void (*)(const reference_data& data, const int* dish);
+
+// for loaders, once `dishes`, `windows` and `tag_dishes` are filled:
+// fills `canteen_dishes`, `window_dishes` and `names`, and `tags`
+// and the `tags` of the windows with those of `all_tags` that have
+// dishes there.
+void index_menu(reference_data& data, boost::json::array all_tags);
+
+// loads the first snapshot through `conn` with `load`, which is used
+// for every later one, and `load_dish` for writes to one dish. every
+// `check_interval` seconds (0 for never) a background thread loads
+// the data again through the read pool, and publishes it if it
+// differs from the current snapshot, for writes made outside the
+// server (menu_tool, psql).
+void init_reference_data(
+	const std::shared_ptr<bserv::db_connection>& conn,
+	reference_loader load,
+	dish_loader load_dish,
+	int check_interval = 300);
+
+// the current snapshot, for the pages that read the menu. the
+// published one is taken without a connection, and without waiting
+// for a reload in progress. only if a reload after a write failed is
+// it loaded, through the read pool, and other threads wait for that.
+std::shared_ptr<const reference_data> reference_snapshot();
+
+// the same, loaded through `conn` if it has to be, for callers that
+// hold a connection already.
+std::shared_ptr<const reference_data> get_reference_data(
+	const std::shared_ptr<bserv::db_connection>& conn);
+
+// to be called after committing a write to the canteens, windows,
+// tags, dishes or dish tags. readers keep the old snapshot until the
+// new one is loaded through `conn` and published. errors are logged,
+// not thrown, and the next reader loads it then.
+void reload_reference_data(const std::shared_ptr<bserv::db_connection>& conn);
+
+// to be called after committing a write that added, updated or
+// deleted the dish `id` and changed nothing else. only that dish is
+// loaded through `conn`, and patched into a copy of the snapshot.
+// errors are handled like those of reload_reference_data.
+void reload_dish(const std::shared_ptr<bserv::db_connection>& conn, int id);
+
+// adds `listener`, which is then called with every new snapshot.
+void on_reference_data(reference_listener listener);
+
+// empty if `map` has nothing for `id`.
+const boost::json::array& find_or_empty(
+	const std::unordered_map<int, boost::json::array>& map,
+	int id);
+
+// `name` as it is searched: ascii letters are lowercased, full width
+// forms (as chinese input methods type them) are folded to ascii, and
+// the ideographic space to a space. utf-8 keeps code point order in
+// byte order, so the rest is compared as is. an incomplete character
+// at the end, from a search typed so far, is dropped.
+std::string normalize_name(const std::string& name);
+
+// the dishes whose name starts with `prefix`, normalized, found by
+// binary search in `names`.
+dish_bitmap find_dishes_by_prefix(const reference_data& data, const std::string& prefix);
+
+// the positions of the first `limit` of those in name order, for
+// search as you type.
+std::vector<std::uint32_t> first_dishes_by_prefix(
+	const reference_data& data,
+	const std::string& prefix,
+	std::size_t limit);
+
+// the dishes of `canteen` sold at `window` (0 for any) with all of
+// `tags`, or with any of them unless `match_all`, whose name starts
+// with `prefix`, in D_ order.
+boost::json::array find_menu_dishes(
+	const reference_data& data,
+	int canteen,
+	int window,
+	const std::vector<int>& tags,
+	bool match_all,
+	const std::string& prefix);
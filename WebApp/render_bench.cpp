@@ -0,0 +1,115 @@
+// render_bench: times the steps of rendering a menu page with a
+// context of generated dishes. the context goes to inja converted
+// directly, or serialized and parsed back; the template is parsed
+// once and cached, or parsed for each page.
+//
+// usage: render_bench template_root [dishes] [iterations]
+//        defaults: 500 dishes, 2000 iterations
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <cstdlib>
+
+#include <boost/json.hpp>
+#include <inja/inja.hpp>
+
+#include "inja_json.h"
+
+namespace {
+
+	const std::string page = "dishes.html";
+
+	// a canteen page as redirect_to_canteen_index fills it, with
+	// `dishes` dishes over 20 windows and 30 tags.
+	boost::json::object menu_context(int dishes) {
+		std::mt19937 random{ 42 };
+		std::uniform_int_distribution<int> count{ 0, 50 };
+		boost::json::array tags;
+		for (int tag = 1; tag <= 30; ++tag)
+			tags.push_back({ {"T_", tag}, {"Tname", "tag " + std::to_string(tag)}, {"count", count(random)} });
+		boost::json::array windows;
+		for (int window = 1; window <= 20; ++window) {
+			boost::json::array window_tags;
+			for (int tag = window; tag < window + 5; ++tag)
+				window_tags.push_back({ {"T_", tag}, {"Tname", "tag " + std::to_string(tag)}, {"count", count(random)} });
+			windows.push_back({ {"W_", window}, {"Wname", "window " + std::to_string(window)}, {"tags", std::move(window_tags)} });
+		}
+		boost::json::array menu;
+		for (int dish = 1; dish <= dishes; ++dish) {
+			menu.push_back({
+				{"D_", dish},
+				{"Dname", "dish " + std::to_string(dish)},
+				{"Dprice", 5.5 + dish % 20},
+				{"is_sell", dish % 7 != 0},
+				{"Dpicture", "/" + std::to_string(dish)},
+				{"W_", dish % 20 + 1}
+			});
+		}
+		return {
+			{"user", {{"username", "bench"}}},
+			{"windows", std::move(windows)},
+			{"tags", std::move(tags)},
+			{"dishes", std::move(menu)}
+		};
+	}
+
+	// the mean time of `step` in microseconds.
+	template<typename Step>
+	double time_us(int iterations, Step step) {
+		auto start = std::chrono::steady_clock::now();
+		for (int i = 0; i < iterations; ++i)
+			step();
+		return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / iterations;
+	}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+	if (argc < 2) {
+		std::cerr << "usage: " << argv[0] << " template_root [dishes] [iterations]" << std::endl;
+		return EXIT_FAILURE;
+	}
+	std::string template_root = argv[1];
+	if (template_root.back() != '/')
+		template_root.push_back('/');
+	int dishes = argc > 2 ? std::atoi(argv[2]) : 500;
+	int iterations = argc > 3 ? std::atoi(argv[3]) : 2000;
+	if (dishes <= 0 || iterations <= 0) {
+		std::cerr << "usage: " << argv[0] << " template_root [dishes] [iterations]" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	boost::json::object context = menu_context(dishes);
+	// keeps the results alive, so the steps are not optimized out
+	std::size_t bytes = 0;
+
+	double direct = time_us(iterations, [&]() {
+		bytes += to_inja_json(context).size();
+	});
+	double round_trip = time_us(iterations, [&]() {
+		bytes += inja::json::parse(boost::json::serialize(context)).size();
+	});
+	if (to_inja_json(context) != inja::json::parse(boost::json::serialize(context))) {
+		std::cerr << "the direct conversion differs from the round trip" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	inja::json data = to_inja_json(context);
+	inja::Environment env{ template_root };
+	inja::Template cached = env.parse_template(page);
+	double render_cached = time_us(iterations, [&]() {
+		bytes += env.render(cached, data).size();
+	});
+	double render_parsed = time_us(iterations, [&]() {
+		bytes += env.render(env.parse_template(page), data).size();
+	});
+
+	std::cout << page << " with " << dishes << " dishes, " << iterations << " iterations, mean us\n"
+		<< "context: to_inja_json " << direct << ", serialize and parse " << round_trip << "\n"
+		<< "render: cached template " << render_cached << ", parsed per page " << render_parsed << "\n"
+		<< "(" << bytes << " bytes)" << std::endl;
+	return EXIT_SUCCESS;
+}
@@ -1,38 +1,288 @@
 #include "rendering.h"
+#include "compression.h"
+#include "inja_json.h"
 
 #include <fstream>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <ostream>
+#include <stdexcept>
+#include <string_view>
 
 #include <boost/beast.hpp>
 #include <inja/inja.hpp>
 
+#ifdef WEBAPP_COMPILED_TEMPLATES
+#include "compiled_templates.h"
+#endif
+
+#ifdef WEBAPP_EMBED_RESOURCES
+#include "embedded_resources.h"
+#endif
+
+#ifdef __linux__
+#include <cerrno>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
 std::string template_root_;
-std::string static_root_;
 
-void init_rendering(const std::string& template_root) {
+// the parsed templates, shared by all io threads.
+// a published cache is never modified: reloading builds a copy
+// and swaps it in, so readers only need to grab the pointer.
+struct template_cache {
+	inja::Environment env;
+	std::map<std::string, inja::Template> templates;
+};
+
+std::shared_ptr<template_cache> template_cache_;
+
+// set when templates may change at runtime, compiled
+// templates are not used then.
+bool template_watch_ = false;
+
+bool is_template_file(const std::string& name) {
+	const std::string suffix = ".html";
+	return name.size() > suffix.size()
+		&& name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// the key under which inja stores a template that is
+// `extends`-ed or `include`-d from another template.
+std::string storage_key(const std::string& name) {
+	std::string key = template_root_ + name;
+	if (key.compare(0, 2, "./") == 0)
+		key.erase(0, 2);
+	return key;
+}
+
+// parses `names` on top of `cache`. a template that fails to parse
+// keeps its previous version (if any).
+void compile_templates(
+	template_cache& cache,
+	const std::vector<std::string>& names) {
+	for (const auto& name : names) {
+		try {
+			inja::Template tmpl = cache.env.parse_template(name);
+			// children that extend this template look it up
+			// in the environment's storage at render time.
+			cache.env.include_template(storage_key(name), tmpl);
+			cache.templates[name] = std::move(tmpl);
+			lginfo << "template compiled: " << name << std::endl;
+		}
+		catch (const std::exception& e) {
+			lgerror << "template `" << name << "` not compiled: " << e.what() << std::endl;
+		}
+	}
+}
+
+#ifdef WEBAPP_EMBED_RESOURCES
+// parses the templates packed into the binary. inja does not look
+// for `extends`-ed templates on disk, they are all in its storage.
+void compile_embedded_templates(template_cache& cache) {
+	cache.env.set_search_included_templates_in_files(false);
+	std::size_t count = 0;
+	const embedded_resource* resources = embedded_templates(count);
+	for (std::size_t i = 0; i < count; ++i) {
+		std::string name = resources[i].name;
+		try {
+			inja::Template tmpl = cache.env.parse(
+				std::string_view{ (const char*)resources[i].data, resources[i].size });
+			cache.env.include_template(name, tmpl);
+			cache.templates[name] = std::move(tmpl);
+			lginfo << "template compiled: " << name << " (embedded)" << std::endl;
+		}
+		catch (const std::exception& e) {
+			lgerror << "template `" << name << "` not compiled: " << e.what() << std::endl;
+		}
+	}
+}
+#endif
+
+void reload_templates(const std::vector<std::string>& names) {
+	auto cache = std::make_shared<template_cache>(*std::atomic_load(&template_cache_));
+	compile_templates(*cache, names);
+	std::atomic_store(&template_cache_, cache);
+}
+
+// builds the inja (nlohmann) tree straight from the boost tree,
+// without serializing the context to text and parsing it back.
+inja::json to_inja_json(const boost::json::value& value) {
+	switch (value.kind()) {
+	case boost::json::kind::bool_:
+		return value.as_bool();
+	case boost::json::kind::int64:
+		return value.as_int64();
+	case boost::json::kind::uint64:
+		return value.as_uint64();
+	case boost::json::kind::double_:
+		return value.as_double();
+	case boost::json::kind::string: {
+		const auto& str = value.as_string();
+		return std::string{ str.data(), str.size() };
+	}
+	case boost::json::kind::array: {
+		inja::json arr = inja::json::array();
+		for (const auto& item : value.as_array())
+			arr.push_back(to_inja_json(item));
+		return arr;
+	}
+	case boost::json::kind::object:
+		return to_inja_json(value.as_object());
+	default:
+		return nullptr;
+	}
+}
+
+inja::json to_inja_json(const boost::json::object& obj) {
+	inja::json result = inja::json::object();
+	for (const auto& item : obj)
+		result.emplace(std::string{ item.key() }, to_inja_json(item.value()));
+	return result;
+}
+
+#ifdef __linux__
+void start_template_watch() {
+	int fd = inotify_init1(IN_CLOEXEC);
+	if (fd < 0) {
+		lgerror << "template watch: inotify_init1 failed" << std::endl;
+		return;
+	}
+	if (inotify_add_watch(fd, template_root_.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+		lgerror << "template watch: cannot watch " << template_root_ << std::endl;
+		close(fd);
+		return;
+	}
+	std::thread{ [fd]() {
+		alignas(struct inotify_event) char buffer[4096];
+		while (true) {
+			ssize_t len = read(fd, buffer, sizeof(buffer));
+			if (len < 0 && errno == EINTR) continue;
+			if (len <= 0) break;
+			std::vector<std::string> changed;
+			for (char* p = buffer; p < buffer + len;) {
+				auto* event = reinterpret_cast<struct inotify_event*>(p);
+				if (event->len > 0 && is_template_file(event->name)
+					&& std::find(changed.begin(), changed.end(), event->name) == changed.end())
+					changed.emplace_back(event->name);
+				p += sizeof(struct inotify_event) + event->len;
+			}
+			if (!changed.empty())
+				reload_templates(changed);
+		}
+		lgerror << "template watch stopped" << std::endl;
+		close(fd);
+	} }.detach();
+}
+#endif
+
+void init_rendering(const std::string& template_root, bool watch_templates) {
+	auto cache = std::make_shared<template_cache>();
+#ifdef WEBAPP_EMBED_RESOURCES
+	compile_embedded_templates(*cache);
+	std::atomic_store(&template_cache_, cache);
+	if (watch_templates)
+		lgwarning << "templates are embedded, `" << template_root << "` is not watched" << std::endl;
+#else
 	template_root_ = template_root;
 	if (template_root_[template_root_.size() - 1] != '/')
 		template_root_.push_back('/');
+
+	std::vector<std::string> names;
+	for (const auto& entry : std::filesystem::directory_iterator(template_root_)) {
+		std::string name = entry.path().filename().string();
+		if (entry.is_regular_file() && is_template_file(name))
+			names.push_back(name);
+	}
+	cache->env = inja::Environment{ template_root_ };
+	compile_templates(*cache, names);
+	std::atomic_store(&template_cache_, cache);
+
+	template_watch_ = watch_templates;
+	if (watch_templates) {
+#ifdef __linux__
+		start_template_watch();
+#else
+		lgwarning << "template watch is only supported on linux" << std::endl;
+#endif
+	}
+#endif
 }
 
-void init_static_root(const std::string& static_root) {
-	static_root_ = static_root;
-	if (static_root_[static_root_.size() - 1] != '/')
-		static_root_.push_back('/');
+void render_interpreted(
+	std::string& out,
+	const std::string& template_file,
+	const boost::json::object& context) {
+	inja::json data = to_inja_json(context);
+	body_streambuf buffer{ out };
+	std::ostream os{ &buffer };
+	auto cache = std::atomic_load(&template_cache_);
+	auto it = cache->templates.find(template_file);
+	if (it != cache->templates.end()) {
+		// rendering only reads the environment, so it is safe
+		// to share it between threads.
+		cache->env.render_to(os, it->second, data);
+	}
+	else {
+#ifdef WEBAPP_EMBED_RESOURCES
+		throw std::runtime_error{ "template `" + template_file + "` is not embedded" };
+#else
+		inja::Environment env;
+		env.render_to(os, env.parse_template(template_root_ + template_file), data);
+#endif
+	}
+}
+
+std::string escape_html(const std::string& text) {
+	std::string result;
+	result.reserve(text.size());
+	for (char c : text) {
+		switch (c) {
+		case '&': result += "&amp;"; break;
+		case '<': result += "&lt;"; break;
+		case '>': result += "&gt;"; break;
+		case '"': result += "&quot;"; break;
+		case '\'': result += "&#39;"; break;
+		default: result += c;
+		}
+	}
+	return result;
 }
 
 std::nullopt_t render(
+	const bserv::request_type& request,
 	bserv::response_type& response,
 	const std::string& template_file,
 	const boost::json::object& context) {
 	response.set(bserv::http::field::content_type, "text/html");
-	inja::json data = inja::json::parse(boost::json::serialize(context));
-	response.body() = inja::Environment{}.render_file(template_root_ + template_file, data);
+	response.body().clear();
+#ifdef WEBAPP_COMPILED_TEMPLATES
+	compiled_template compiled = template_watch_ ? nullptr : find_compiled_template(template_file);
+	if (compiled != nullptr) {
+		compiled(response.body(), context);
+#ifdef WEBAPP_CHECK_COMPILED_TEMPLATES
+		// inja is the reference for the generated code, each page is
+		// rendered twice
+		std::string expected;
+		render_interpreted(expected, template_file, context);
+		if (response.body() != expected) {
+			lgerror << "compiled template `" << template_file
+				<< "` does not match the inja output" << std::endl;
+			response.body() = std::move(expected);
+		}
+#endif
+		response.prepare_payload();
+		compress_response(request, response);
+		return std::nullopt;
+	}
+#endif
+	render_interpreted(response.body(), template_file, context);
 	response.prepare_payload();
+	compress_response(request, response);
 	return std::nullopt;
 }
-
-std::nullopt_t serve(
-	bserv::response_type& response,
-	const std::string& file) {
-	return bserv::utils::file::serve(response, static_root_ + file);
-}
@@ -2,21 +2,47 @@
 
 #include <string>
 #include <optional>
+#include <streambuf>
 
 #include <boost/json.hpp>
 #include "bserv/common.hpp"
 
-void init_rendering(const std::string& template_root);
+// parses every template under `template_root` once. with
+// `watch_templates`, changed files are recompiled on the fly.
+void init_rendering(const std::string& template_root, bool watch_templates = false);
 
-void init_static_root(const std::string& static_root);
+// `text` with the characters html gives a meaning to replaced by
+// entities, for text typed by users that a template prints as is.
+std::string escape_html(const std::string& text);
 
+// an output buffer that appends to a response body, so pages and
+// exports are written into the body instead of into a string
+// stream that is copied later. the body is the only buffer, it is
+// not sent before the handler returns.
+class body_streambuf : public std::streambuf {
+public:
+	explicit body_streambuf(std::string& body) : body_{ body } {}
+
+protected:
+	int_type overflow(int_type ch) override {
+		if (!traits_type::eq_int_type(ch, traits_type::eof()))
+			body_.push_back(traits_type::to_char_type(ch));
+		return traits_type::not_eof(ch);
+	}
+
+	std::streamsize xsputn(const char* s, std::streamsize n) override {
+		body_.append(s, (std::size_t)n);
+		return n;
+	}
+
+private:
+	std::string& body_;
+};
+
+// the page is gzip compressed if the client accepts it.
 std::nullopt_t render(
+	const bserv::request_type& request,
 	bserv::response_type& response,
 	const std::string& template_path,
 	const boost::json::object& context = {}
 );
-
-std::nullopt_t serve(
-	bserv::response_type& response,
-	const std::string& file
-);
@@ -0,0 +1,148 @@
+// resource_packer: packs the templates and static files into a C++
+// source file, see `embedded_resources.h`.
+//
+// usage: resource_packer <template_root> <static_root> <output.cpp>
+//
+// the etags and gzip variants come from `static_content.h`, the same
+// code the static file cache runs, so both modes answer alike.
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+#include <stdexcept>
+
+#include "static_content.h"
+
+struct resource {
+	std::string name;
+	std::string content;
+	std::string gzip;
+	std::string etag;
+	long long mtime;
+};
+
+std::string read_file(const std::filesystem::path& path) {
+	std::ifstream in{ path, std::ios::binary };
+	if (!in)
+		throw std::runtime_error{ "cannot read " + path.string() };
+	std::ostringstream os;
+	os << in.rdbuf();
+	return os.str();
+}
+
+resource load(const std::filesystem::path& path, const std::string& name) {
+	resource res;
+	res.name = name;
+	res.content = read_file(path);
+	res.etag = make_etag(res.content);
+	res.mtime = (long long)file_mtime(path);
+	res.gzip = gzip_variant(res.content, mime_type(name));
+	return res;
+}
+
+std::string escape(const std::string& str) {
+	std::string out;
+	for (unsigned char c : str) {
+		if (c == '"' || c == '\\')
+			out += '\\';
+		out += (char)c;
+	}
+	return out;
+}
+
+void write_bytes(std::ostream& out, const std::string& symbol, const std::string& data) {
+	out << "const unsigned char " << symbol << "[] = {";
+	for (std::size_t i = 0; i < data.size(); ++i) {
+		if (i % 32 == 0)
+			out << "\n\t";
+		out << (unsigned)(unsigned char)data[i] << ',';
+	}
+	// arrays may not be empty
+	if (data.empty())
+		out << "0";
+	out << "\n};\n";
+}
+
+void write_table(
+	std::ostream& out,
+	const std::string& table,
+	const std::vector<resource>& resources) {
+	for (std::size_t i = 0; i < resources.size(); ++i) {
+		write_bytes(out, table + "_" + std::to_string(i), resources[i].content);
+		if (!resources[i].gzip.empty())
+			write_bytes(out, table + "_" + std::to_string(i) + "_gz", resources[i].gzip);
+	}
+	out << "const embedded_resource " << table << "[] = {\n";
+	for (std::size_t i = 0; i < resources.size(); ++i) {
+		const auto& res = resources[i];
+		std::string symbol = table + "_" + std::to_string(i);
+		out << "\t{ \"" << escape(res.name) << "\", " << symbol << ", " << res.content.size() << ", ";
+		if (res.gzip.empty())
+			out << "nullptr, 0, ";
+		else
+			out << symbol << "_gz, " << res.gzip.size() << ", ";
+		out << "\"" << escape(res.etag) << "\", " << res.mtime << " },\n";
+	}
+	if (resources.empty())
+		out << "\t{ nullptr, nullptr, 0, nullptr, 0, nullptr, 0 }\n";
+	out << "};\n\n";
+}
+
+int main(int argc, char* argv[]) {
+	if (argc != 4) {
+		std::cerr << "usage: " << argv[0] << " <template_root> <static_root> <output.cpp>" << std::endl;
+		return EXIT_FAILURE;
+	}
+	try {
+		std::filesystem::path template_root{ argv[1] };
+		std::filesystem::path static_root{ argv[2] };
+		std::vector<resource> templates, statics;
+		for (const auto& entry : std::filesystem::directory_iterator(template_root)) {
+			std::string name = entry.path().filename().string();
+			if (entry.is_regular_file() && entry.path().extension() == ".html")
+				templates.push_back(load(entry.path(), name));
+		}
+		for (auto it = std::filesystem::recursive_directory_iterator(static_root);
+			it != std::filesystem::recursive_directory_iterator(); ++it) {
+			std::string name = std::filesystem::relative(it->path(), static_root).generic_string();
+			// generated image variants are not part of the source tree
+			if (it.depth() == 0 && it->is_directory() && name == "thumbs") {
+				it.disable_recursion_pending();
+				continue;
+			}
+			if (it->is_regular_file())
+				statics.push_back(load(it->path(), name));
+		}
+		auto by_name = [](const resource& a, const resource& b) { return a.name < b.name; };
+		std::sort(templates.begin(), templates.end(), by_name);
+		std::sort(statics.begin(), statics.end(), by_name);
+
+		std::ofstream out{ argv[3], std::ios::binary | std::ios::trunc };
+		out << "// generated by resource_packer, do not edit.\n\n"
+			<< "#include \"embedded_resources.h\"\n\n"
+			<< "namespace {\n\n";
+		write_table(out, "templates", templates);
+		write_table(out, "statics", statics);
+		out << "} // namespace\n\n"
+			<< "const embedded_resource* embedded_templates(std::size_t& count) {\n"
+			<< "\tcount = " << templates.size() << ";\n"
+			<< "\treturn templates;\n"
+			<< "}\n\n"
+			<< "const embedded_resource* embedded_statics(std::size_t& count) {\n"
+			<< "\tcount = " << statics.size() << ";\n"
+			<< "\treturn statics;\n"
+			<< "}\n";
+		if (!out)
+			throw std::runtime_error{ std::string{ "cannot write " } + argv[3] };
+	}
+	catch (const std::exception& e) {
+		std::cerr << e.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,112 @@
+// search_bench: times search_dishes on a generated index, of dishes
+// with chinese names and remarks whose characters follow a zipf
+// distribution, as words of a language do.
+//
+// usage: search_bench [dishes] [remarks] [queries]
+//        defaults: 100000 dishes, 10000000 remarks, 10000 queries
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+#include "search_index.h"
+
+namespace {
+
+	// common characters, from U+4E00
+	constexpr int alphabet = 3000;
+
+	std::string utf8(char32_t code) {
+		std::string result;
+		result += (char)(0xe0 | (code >> 12));
+		result += (char)(0x80 | ((code >> 6) & 0x3f));
+		result += (char)(0x80 | (code & 0x3f));
+		return result;
+	}
+
+	class text_generator {
+	public:
+		explicit text_generator(unsigned seed) : random_{ seed } {
+			std::vector<double> weights(alphabet);
+			for (int i = 0; i < alphabet; ++i)
+				weights[i] = 1.0 / (i + 1);
+			characters_ = std::discrete_distribution<int>(weights.begin(), weights.end());
+		}
+
+		std::string text(int min_length, int max_length) {
+			int length = std::uniform_int_distribution<int>{ min_length, max_length }(random_);
+			std::string result;
+			for (int i = 0; i < length; ++i)
+				result += utf8(0x4e00 + characters_(random_));
+			return result;
+		}
+
+		int uniform(int min, int max) {
+			return std::uniform_int_distribution<int>{ min, max }(random_);
+		}
+
+	private:
+		std::mt19937 random_;
+		std::discrete_distribution<int> characters_;
+	};
+
+	double since(std::chrono::steady_clock::time_point start) {
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+	long long dishes = argc > 1 ? std::atoll(argv[1]) : 100000;
+	long long remarks = argc > 2 ? std::atoll(argv[2]) : 10000000;
+	long long queries = argc > 3 ? std::atoll(argv[3]) : 10000;
+	if (dishes <= 0 || remarks < 0 || queries <= 0) {
+		std::cerr << "usage: " << argv[0] << " [dishes] [remarks] [queries]" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	text_generator generator{ 42 };
+	auto start = std::chrono::steady_clock::now();
+	std::vector<std::string> names;
+	for (long long dish = 1; dish <= dishes; ++dish) {
+		names.push_back(generator.text(2, 6));
+		index_dish_name((int)dish, names.back());
+	}
+	// in D_ order, as the server loads them
+	for (long long i = 0; i < remarks; ++i)
+		index_remark((int)(i * dishes / remarks + 1), generator.text(8, 40), generator.uniform(0, 100));
+	std::cout << "indexed " << dishes << " dishes and " << remarks << " remarks in "
+		<< since(start) << " s" << std::endl;
+
+	// half the queries are part of a name, half are random text
+	std::vector<std::string> texts;
+	for (long long i = 0; i < queries; ++i) {
+		if (i % 2 == 0) {
+			const std::string& name = names[generator.uniform(0, (int)dishes - 1)];
+			texts.push_back(name.substr(0, std::min<std::size_t>(name.size(), 3 * generator.uniform(1, 3))));
+		}
+		else {
+			texts.push_back(generator.text(1, 4));
+		}
+	}
+	std::vector<double> times;
+	std::size_t hits = 0;
+	for (const std::string& text : texts) {
+		auto query_start = std::chrono::steady_clock::now();
+		hits += search_dishes(text, 50).size();
+		times.push_back(since(query_start) * 1e6);
+	}
+	std::sort(times.begin(), times.end());
+	auto percentile = [&](double p) {
+		return times[std::min(times.size() - 1, (std::size_t)(p * times.size()))];
+	};
+	std::cout << queries << " queries, " << (double)hits / queries << " hits each\n"
+		<< "p50 " << percentile(0.5) << " us, p99 " << percentile(0.99)
+		<< " us, max " << times.back() << " us" << std::endl;
+	return EXIT_SUCCESS;
+}
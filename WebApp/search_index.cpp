@@ -0,0 +1,423 @@
+#include "search_index.h"
+
+#include <cmath>
+#include <chrono>
+#include <mutex>
+#include <shared_mutex>
+#include <algorithm>
+#include <functional>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <pqxx/pqxx>
+
+#include "metrics.h"
+#include "reference_data.h"
+
+namespace {
+
+	// bm25 parameters
+	constexpr double k1 = 1.2;
+	constexpr double b = 0.75;
+	// a dish name counts as many times as this, it says more about
+	// the dish than a remark does.
+	constexpr std::uint32_t name_weight = 5;
+	// a dish scored 100 on average ranks this much higher.
+	constexpr double mark_boost = 0.5;
+
+	constexpr int load_batch = 10000;
+
+	metric_counter& queries_ = get_counter("search.queries");
+	metric_counter& query_ns_ = get_counter("search.query_ns");
+
+	struct document {
+		int dish = 0;
+		// the normalized name, as indexed.
+		std::string name;
+		int remarks = 0;
+		long long mark_sum = 0;
+	};
+
+	// a document having a gram, `count` times.
+	struct posting {
+		std::uint32_t doc;
+		std::uint32_t count;
+	};
+
+	std::shared_mutex mutex_;
+	// documents are numbered densely, so that the postings hold
+	// small numbers and scores go in an array. the number of a
+	// document without name and remarks is given to the next one.
+	std::vector<document> documents_;
+	// the grams of each document, the name counted name_weight times.
+	// apart from documents_, the scoring loop reads them in order.
+	std::vector<std::uint32_t> lengths_;
+	// the factor of the average mark of each document.
+	std::vector<float> boosts_;
+	std::vector<std::uint32_t> free_documents_;
+	std::unordered_map<int, std::uint32_t> document_of_;
+	// the documents having each gram, sorted by number.
+	std::unordered_map<std::uint64_t, std::vector<posting>> postings_;
+	std::uint64_t total_length_ = 0;
+
+	// the code points of normalized `text`, with 0 in place of spaces
+	// and punctuation, ascii or cjk, which grams do not span.
+	std::u32string code_points(const std::string& text) {
+		std::string normalized = normalize_name(text);
+		std::u32string result;
+		for (std::size_t i = 0; i < normalized.size();) {
+			unsigned char c = normalized[i];
+			std::size_t length = c < 0x80 ? 1 : (c >> 5) == 0x6 ? 2 : (c >> 4) == 0xe ? 3 : (c >> 3) == 0x1e ? 4 : 1;
+			char32_t code = length == 1 ? c : length == 2 ? c & 0x1f : length == 3 ? c & 0x0f : c & 0x07;
+			for (std::size_t j = 1; j < length; ++j)
+				code = code << 6 | (normalized[i + j] & 0x3f);
+			if ((length == 1 && !((c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || c >= 0x80))
+				|| (code >= 0x3000 && code <= 0x303f))
+				code = 0;
+			result.push_back(code);
+			i += length;
+		}
+		return result;
+	}
+
+	// the bigrams of `text`. a run of one character between breaks is
+	// a gram by itself, and so is every character if `unigrams`, so
+	// that one character queries find names.
+	std::vector<std::uint64_t> grams(const std::string& text, bool unigrams) {
+		std::u32string codes = code_points(text);
+		std::vector<std::uint64_t> result;
+		for (std::size_t i = 0; i < codes.size(); ++i) {
+			if (codes[i] == 0)
+				continue;
+			bool next = i + 1 < codes.size() && codes[i + 1] != 0;
+			bool previous = i > 0 && codes[i - 1] != 0;
+			if (unigrams || (!next && !previous))
+				result.push_back(codes[i]);
+			if (next)
+				result.push_back(std::uint64_t{ 1 } << 63 | std::uint64_t{ codes[i] } << 21 | codes[i + 1]);
+		}
+		return result;
+	}
+
+	// call with mutex_ held exclusively. the document of `dish`,
+	// numbered if it has none.
+	std::uint32_t find_document(int dish) {
+		auto it = document_of_.find(dish);
+		if (it != document_of_.end())
+			return it->second;
+		std::uint32_t doc;
+		if (free_documents_.empty()) {
+			doc = (std::uint32_t)documents_.size();
+			documents_.emplace_back();
+			lengths_.push_back(0);
+			boosts_.push_back(1);
+		}
+		else {
+			doc = free_documents_.back();
+			free_documents_.pop_back();
+		}
+		documents_[doc].dish = dish;
+		document_of_.emplace(dish, doc);
+		return doc;
+	}
+
+	// a document without name and remarks has no grams left. it is
+	// dropped, or it would still count in the idf.
+	void drop_if_empty(std::uint32_t doc) {
+		document& document = documents_[doc];
+		if (!document.name.empty() || document.remarks > 0)
+			return;
+		document_of_.erase(document.dish);
+		document = {};
+		boosts_[doc] = 1;
+		free_documents_.push_back(doc);
+	}
+
+	void add_mark(std::uint32_t doc, int remarks, long long mark) {
+		document& document = documents_[doc];
+		document.remarks += remarks;
+		document.mark_sum += mark;
+		double average = document.remarks == 0 ? 0
+			: std::clamp((double)document.mark_sum / document.remarks / 100, 0.0, 1.0);
+		boosts_[doc] = (float)(1 + mark_boost * average);
+	}
+
+	void add_grams(std::uint32_t doc, const std::vector<std::uint64_t>& grams, std::uint32_t weight) {
+		for (std::uint64_t gram : grams) {
+			std::vector<posting>& postings = postings_[gram];
+			// while loading, documents are numbered in order and
+			// appended
+			auto it = postings.empty() || postings.back().doc < doc ? postings.end()
+				: postings.back().doc == doc ? postings.end() - 1
+				: std::lower_bound(postings.begin(), postings.end(), doc,
+					[](const posting& p, std::uint32_t doc) { return p.doc < doc; });
+			if (it != postings.end() && it->doc == doc)
+				it->count += weight;
+			else
+				postings.insert(it, { doc, weight });
+		}
+		lengths_[doc] += (std::uint32_t)(grams.size() * weight);
+		total_length_ += grams.size() * weight;
+	}
+
+	void remove_grams(std::uint32_t doc, const std::vector<std::uint64_t>& grams, std::uint32_t weight) {
+		for (std::uint64_t gram : grams) {
+			auto postings = postings_.find(gram);
+			if (postings == postings_.end())
+				continue;
+			auto it = std::lower_bound(postings->second.begin(), postings->second.end(), doc,
+				[](const posting& p, std::uint32_t doc) { return p.doc < doc; });
+			if (it == postings->second.end() || it->doc != doc)
+				continue;
+			it->count -= std::min(it->count, weight);
+			if (it->count == 0)
+				postings->second.erase(it);
+			if (postings->second.empty())
+				postings_.erase(postings);
+		}
+		std::uint32_t length = (std::uint32_t)std::min<std::uint64_t>(lengths_[doc], grams.size() * weight);
+		lengths_[doc] -= length;
+		total_length_ -= length;
+	}
+
+	// call with mutex_ held exclusively.
+	void index_name(int dish, std::string name) {
+		auto it = document_of_.find(dish);
+		if (it == document_of_.end() && name.empty())
+			return;
+		std::uint32_t doc = it == document_of_.end() ? find_document(dish) : it->second;
+		if (documents_[doc].name == name)
+			return;
+		remove_grams(doc, grams(documents_[doc].name, true), name_weight);
+		add_grams(doc, grams(name, true), name_weight);
+		documents_[doc].name = std::move(name);
+		drop_if_empty(doc);
+	}
+
+	// follows the dish names of the menu snapshots. the remarks of a
+	// deleted dish stay indexed, its hits are dropped by the pages.
+	// a snapshot patched for one dish only changes its name.
+	void index_names(const reference_data& data, const int* changed) {
+		if (changed != nullptr) {
+			auto it = data.positions.find(*changed);
+			std::string name = it == data.positions.end()
+				? std::string{} : normalize_name(data.dishes[it->second]->name);
+			std::unique_lock<std::shared_mutex> lock{ mutex_ };
+			index_name(*changed, std::move(name));
+			return;
+		}
+		std::unique_lock<std::shared_mutex> lock{ mutex_ };
+		std::unordered_set<int> current;
+		for (const auto& dish : data.dishes) {
+			if (dish == nullptr)
+				continue;
+			current.insert(dish->id);
+			index_name(dish->id, normalize_name(dish->name));
+		}
+		for (std::uint32_t doc = 0; doc < documents_.size(); ++doc)
+			if (!documents_[doc].name.empty() && current.count(documents_[doc].dish) == 0)
+				index_name(documents_[doc].dish, {});
+	}
+
+} // namespace
+
+void init_search_index(const std::shared_ptr<bserv::db_connection>& conn) {
+	{
+		pqxx::read_transaction tx{ conn->get() };
+		// in D_ order, so that each dish is numbered after the ones
+		// before it and its postings are appended
+		pqxx::icursorstream cursor{ tx, "select D_, Rcontext, Rmark from remark order by D_", "search_remarks", load_batch };
+		pqxx::result rows;
+		std::unique_lock<std::shared_mutex> lock{ mutex_ };
+		while (cursor >> rows) {
+			for (const auto& row : rows) {
+				std::uint32_t doc = find_document(row[0].as<int>());
+				if (!row[1].is_null())
+					add_grams(doc, grams(row[1].as<std::string>(), false), 1);
+				add_mark(doc, 1, row[2].is_null() ? 0 : row[2].as<int>());
+			}
+		}
+	}
+	on_reference_data(index_names);
+	index_names(*get_reference_data(conn), nullptr);
+	lginfo << "search index: " << document_of_.size() << " dishes, "
+		<< postings_.size() << " grams" << std::endl;
+}
+
+void index_dish_name(int dish, const std::string& name) {
+	std::string normalized = normalize_name(name);
+	std::unique_lock<std::shared_mutex> lock{ mutex_ };
+	index_name(dish, std::move(normalized));
+}
+
+void index_remark(int dish, const std::string& text, int mark) {
+	auto remark_grams = grams(text, false);
+	std::unique_lock<std::shared_mutex> lock{ mutex_ };
+	std::uint32_t doc = find_document(dish);
+	add_grams(doc, remark_grams, 1);
+	add_mark(doc, 1, mark);
+}
+
+void unindex_remark(int dish, const std::string& text, int mark) {
+	auto remark_grams = grams(text, false);
+	std::unique_lock<std::shared_mutex> lock{ mutex_ };
+	auto it = document_of_.find(dish);
+	if (it == document_of_.end())
+		return;
+	std::uint32_t doc = it->second;
+	remove_grams(doc, remark_grams, 1);
+	if (documents_[doc].remarks > 0)
+		add_mark(doc, -1, -mark);
+	drop_if_empty(doc);
+}
+
+std::vector<search_hit> search_dishes(const std::string& query, std::size_t limit) {
+	auto start = std::chrono::steady_clock::now();
+	std::vector<std::uint64_t> query_grams = grams(query, false);
+	// a one character query has no bigram, it looks up the character
+	std::sort(query_grams.begin(), query_grams.end());
+	query_grams.erase(std::unique(query_grams.begin(), query_grams.end()), query_grams.end());
+
+	// the scores by document, kept zero between queries
+	thread_local std::vector<float> scores;
+	thread_local std::vector<std::uint32_t> matched;
+	thread_local std::vector<float> partials;
+	std::shared_lock<std::shared_mutex> lock{ mutex_ };
+	if (scores.size() < documents_.size())
+		scores.resize(documents_.size());
+	double documents = (double)document_of_.size();
+	double average_length = documents == 0 ? 1 : std::max(1.0, total_length_ / documents);
+	// bm25 with the length normalization taken apart
+	double base = k1 * (1 - b);
+	double per_gram = k1 * b / average_length;
+
+	struct query_gram {
+		const std::vector<posting>* postings;
+		double idf;
+	};
+	std::vector<query_gram> terms;
+	for (std::uint64_t gram : query_grams) {
+		auto postings = postings_.find(gram);
+		if (postings == postings_.end())
+			continue;
+		double df = (double)postings->second.size();
+		terms.push_back({ &postings->second, std::log(1 + (documents - df + 0.5) / (df + 0.5)) });
+	}
+	// the rarest grams first, they score the most and match the fewest
+	std::sort(terms.begin(), terms.end(),
+		[](const query_gram& a, const query_gram& b) { return a.idf > b.idf; });
+	// the most the grams from i on can add to a score, before the boost
+	std::vector<double> rest(terms.size() + 1, 0);
+	for (std::size_t i = terms.size(); i-- > 0;)
+		rest[i] = rest[i + 1] + terms[i].idf * (k1 + 1);
+
+	// once a document not matched yet could not beat the `limit`th
+	// best score so far, the later grams only score the ones matched,
+	// found by seeking in their sorted postings. the common grams of
+	// a query, with the longest postings, come last.
+	bool open = true;
+	float best = 0;
+	for (std::size_t i = 0; i < terms.size(); ++i) {
+		if (limit > 0 && matched.size() >= limit && rest[i] < best) {
+			// the `limit`th best so far, with the boosts. the later
+			// grams only add to these
+			partials.clear();
+			for (std::uint32_t doc : matched)
+				partials.push_back(scores[doc] * boosts_[doc]);
+			std::nth_element(partials.begin(), partials.begin() + (limit - 1), partials.end(), std::greater<float>{});
+			double threshold = partials[limit - 1];
+			if (rest[i] * (1 + mark_boost) < threshold) {
+				// nor could these
+				matched.erase(std::remove_if(matched.begin(), matched.end(), [&](std::uint32_t doc) {
+					if ((scores[doc] + rest[i]) * boosts_[doc] >= threshold)
+						return false;
+					scores[doc] = 0;
+					return true;
+				}), matched.end());
+				// in document order, one sorted run per gram so far. when
+				// many are left, reading them off the scores is cheaper
+				if (open && matched.size() > documents_.size() / 64) {
+					matched.clear();
+					for (std::uint32_t doc = 0; doc < documents_.size(); ++doc)
+						if (scores[doc] != 0)
+							matched.push_back(doc);
+				}
+				else if (open)
+					std::sort(matched.begin(), matched.end());
+				open = false;
+			}
+		}
+		// the scores are floats, so is the arithmetic
+		float weight = (float)(terms[i].idf * (k1 + 1));
+		float flat = (float)base;
+		float by_length = (float)per_gram;
+		const std::vector<posting>& postings = *terms[i].postings;
+		if (open) {
+			for (const posting& p : postings) {
+				float tf = (float)p.count;
+				if (scores[p.doc] == 0)
+					matched.push_back(p.doc);
+				scores[p.doc] += weight * tf / (tf + flat + by_length * lengths_[p.doc]);
+				best = std::max(best, scores[p.doc]);
+			}
+		}
+		else {
+			// galloping, the next matched document is mostly near
+			auto before = [](const posting& p, std::uint32_t doc) { return p.doc < doc; };
+			auto it = postings.begin();
+			for (std::uint32_t doc : matched) {
+				std::size_t step = 1;
+				auto bound = it;
+				while (postings.end() - bound > (std::ptrdiff_t)step && bound[step].doc < doc) {
+					bound += step;
+					step *= 2;
+				}
+				auto last = postings.end() - bound > (std::ptrdiff_t)step ? bound + step + 1 : postings.end();
+				it = std::lower_bound(bound, last, doc, before);
+				if (it == postings.end())
+					break;
+				if (it->doc != doc)
+					continue;
+				float tf = (float)it->count;
+				scores[doc] += weight * tf / (tf + flat + by_length * lengths_[doc]);
+				best = std::max(best, scores[doc]);
+			}
+		}
+	}
+	// with the marks, the best `limit` in a heap, worst on top. few
+	// documents beat the worst, so most cost a compare. ties go to the
+	// document numbered first, mostly the lower D_.
+	struct candidate {
+		float score;
+		std::uint32_t doc;
+	};
+	auto better = [](const candidate& a, const candidate& b) {
+		return a.score != b.score ? a.score > b.score : a.doc < b.doc;
+	};
+	thread_local std::vector<candidate> candidates;
+	for (std::uint32_t doc : matched) {
+		candidate c{ scores[doc] * boosts_[doc], doc };
+		scores[doc] = 0;
+		if (candidates.size() < limit) {
+			candidates.push_back(c);
+			std::push_heap(candidates.begin(), candidates.end(), better);
+		}
+		else if (limit > 0 && better(c, candidates.front())) {
+			std::pop_heap(candidates.begin(), candidates.end(), better);
+			candidates.back() = c;
+			std::push_heap(candidates.begin(), candidates.end(), better);
+		}
+	}
+	matched.clear();
+	std::sort_heap(candidates.begin(), candidates.end(), better);
+	std::vector<search_hit> hits;
+	for (const candidate& c : candidates)
+		hits.push_back({ documents_[c.doc].dish, c.score });
+	candidates.clear();
+	lock.unlock();
+
+	query_ns_.add((std::uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now() - start).count());
+	queries_.add();
+	return hits;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstddef>
+
+#include "bserv/common.hpp"
+
+// full text search over the dish names and the remarks of each dish.
+// text is normalized like dish names and cut into character bigrams,
+// chinese has no spaces to cut words at. each dish is one document,
+// ranked with bm25 and boosted by its average remark score.
+
+struct search_hit {
+	int dish;
+	double score;
+};
+
+// indexes every remark, read through `conn`, and the dish names of
+// the menu snapshot, whose later snapshots it then follows. the
+// reference data must be initialized.
+void init_search_index(const std::shared_ptr<bserv::db_connection>& conn);
+
+// indexes `name` as the name of `dish`, in place of the one indexed,
+// as init_search_index does for each menu snapshot. for filling the
+// index without a database.
+void index_dish_name(int dish, const std::string& name);
+
+// to be called after committing a remark of `dish` with `text` and
+// `mark`.
+void index_remark(int dish, const std::string& text, int mark);
+
+// to be called after committing the deletion of such a remark.
+void unindex_remark(int dish, const std::string& text, int mark);
+
+// the `limit` dishes matching `query` best, best first.
+std::vector<search_hit> search_dishes(const std::string& query, std::size_t limit);
@@ -0,0 +1,178 @@
+#include "statements.h"
+
+#include <map>
+#include <set>
+#include <mutex>
+#include <cctype>
+#include <stdexcept>
+
+std::mutex statements_mutex_;
+
+// function statics, statements are registered during static
+// initialization of other files.
+std::map<std::string, prepared_statement>& statements() {
+	static std::map<std::string, prepared_statement> statements;
+	return statements;
+}
+
+// the connections every statement has been prepared on. a pool that
+// closes a connection removes it with forget_statements.
+std::set<const pqxx::connection*>& prepared_connections() {
+	static std::set<const pqxx::connection*> connections;
+	return connections;
+}
+
+std::string register_statement(const std::string& name, const std::string& sql) {
+	prepared_statement statement;
+	statement.name = name;
+	statement.prepare = "PREPARE " + name + " AS ";
+	int params = 0;
+	for (char c : sql) {
+		if (c == '?')
+			statement.prepare += "$" + std::to_string(++params);
+		else
+			statement.prepare += c;
+	}
+	statement.execute = "EXECUTE " + name;
+	for (int i = 0; i < params; ++i)
+		statement.execute += i == 0 ? "(?" : ", ?";
+	if (params > 0)
+		statement.execute += ")";
+	statement.calls = &get_counter("sql." + name + ".calls");
+	statement.exec_ns = &get_counter("sql." + name + ".exec_ns");
+	statement.prepare_ns = &get_counter("sql." + name + ".prepare_ns");
+	statement.plans = &get_counter("sql." + name + ".plans");
+	statement.plan_ns = &get_counter("sql." + name + ".plan_ns");
+
+	std::lock_guard<std::mutex> lock{ statements_mutex_ };
+	if (!statements().emplace(name, std::move(statement)).second)
+		throw std::logic_error{ "statement `" + name + "` registered twice" };
+	return name;
+}
+
+namespace {
+
+	// postgres folds the unquoted names to lower case.
+	std::string folded(const std::string& name) {
+		std::string result = name;
+		for (char& c : result)
+			c = (char)std::tolower((unsigned char)c);
+		return result;
+	}
+
+	// `exec` runs sql on `conn` and returns its result. the names of
+	// `prepared` are skipped, they are on the connection already.
+	template <typename Exec>
+	void prepare_all(const std::set<std::string>& prepared, Exec exec) {
+		std::size_t count = 0;
+		for (const auto& [name, statement] : statements()) {
+			if (prepared.count(folded(name)) != 0)
+				continue;
+			auto start = std::chrono::steady_clock::now();
+			exec(statement.prepare);
+			statement.prepare_ns->add((std::uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now() - start).count());
+			++count;
+		}
+		lginfo << "prepared " << count << " statements" << std::endl;
+	}
+
+	// `exec` runs sql in the transaction of the caller, on `conn`.
+	template <typename Exec>
+	const prepared_statement& find_statement(
+		const pqxx::connection& conn,
+		const std::string& name,
+		Exec exec) {
+		std::unique_lock<std::mutex> lock{ statements_mutex_ };
+		auto it = statements().find(name);
+		if (it == statements().end())
+			throw std::invalid_argument{ "statement `" + name + "` is not registered" };
+		if (prepared_connections().count(&conn) != 0)
+			return it->second;
+		// the connection belongs to this request, and statements are
+		// not registered any more once requests are served.
+		lock.unlock();
+		// prepared statements are not transactional, so an earlier
+		// transaction that failed half way left some on the connection.
+		// they stay, as do the ones pqxx prepared.
+		std::set<std::string> prepared;
+		auto result = exec("select name from pg_prepared_statements;");
+		for (auto row = result.begin(); row != result.end(); ++row)
+			prepared.insert((*row)[0].template as<std::string>());
+		prepare_all(prepared, exec);
+		lock.lock();
+		prepared_connections().insert(&conn);
+		return it->second;
+	}
+
+} // namespace
+
+void prepare_statements(pqxx::connection& conn) {
+	pqxx::nontransaction tx{ conn };
+	prepare_all({}, [&tx](const std::string& sql) { return tx.exec(sql); });
+	std::lock_guard<std::mutex> lock{ statements_mutex_ };
+	prepared_connections().insert(&conn);
+}
+
+const prepared_statement& get_statement(
+	bserv::db_transaction& tx,
+	const pqxx::connection& conn,
+	const std::string& name) {
+	return find_statement(conn, name, [&tx](const std::string& sql) { return tx.exec(sql); });
+}
+
+const prepared_statement& get_statement(
+	pqxx::transaction_base& tx,
+	const pqxx::connection& conn,
+	const std::string& name) {
+	return find_statement(conn, name, [&tx](const std::string& sql) { return tx.exec(sql); });
+}
+
+void forget_statements(const pqxx::connection& conn) {
+	std::lock_guard<std::mutex> lock{ statements_mutex_ };
+	prepared_connections().erase(&conn);
+}
+
+bool sample_statement_plans(pqxx::connection& conn) {
+	pqxx::read_transaction tx{ conn };
+	// pg_stat_statements keeps the text of the PREPARE, summed here
+	// over the users and databases it counts apart
+	std::string sql = "select s.name, coalesce(sum(p.plans), 0)::bigint, "
+		"coalesce(sum(p.total_plan_time) * 1000000, 0)::bigint from (values ";
+	{
+		std::lock_guard<std::mutex> lock{ statements_mutex_ };
+		bool first = true;
+		for (const auto& [name, statement] : statements()) {
+			sql += (first ? "(" : ", (") + tx.quote(name) + ")";
+			first = false;
+		}
+		if (first)
+			return true;
+	}
+	sql += ") as s(name) left join pg_stat_statements p "
+		"on p.query like 'PREPARE ' || s.name || ' AS %' group by s.name;";
+	pqxx::result result;
+	try {
+		result = tx.exec(sql);
+	}
+	catch (const pqxx::undefined_table&) {
+		return false;
+	}
+	std::lock_guard<std::mutex> lock{ statements_mutex_ };
+	for (const auto& row : result) {
+		auto it = statements().find(row[0].as<std::string>());
+		if (it == statements().end())
+			continue;
+		prepared_statement& statement = it->second;
+		auto plans = row[1].as<std::uint64_t>();
+		auto plan_ns = row[2].as<std::uint64_t>();
+		// the statistics were reset if they went down
+		if (plans >= statement.sampled_plans && plan_ns >= statement.sampled_plan_ns) {
+			statement.plans->add(plans - statement.sampled_plans);
+			statement.plan_ns->add(plan_ns - statement.sampled_plan_ns);
+		}
+		statement.sampled_plans = plans;
+		statement.sampled_plan_ns = plan_ns;
+	}
+	return true;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <string>
+#include <chrono>
+#include <memory>
+
+#include "bserv/common.hpp"
+#include "metrics.h"
+
+// a query that is prepared once on every pooled connection and then
+// run by name, so postgres does not parse it again per request.
+struct prepared_statement {
+	std::string name;
+	// `PREPARE name AS ...` with `$n` parameters.
+	std::string prepare;
+	// `EXECUTE name(?, ...)`, formatted by tx.exec.
+	std::string execute;
+	metric_counter* calls;
+	metric_counter* exec_ns;
+	metric_counter* prepare_ns;
+	// planning, as pg_stat_statements last reported it
+	metric_counter* plans;
+	metric_counter* plan_ns;
+	std::uint64_t sampled_plans = 0;
+	std::uint64_t sampled_plan_ns = 0;
+};
+
+// registers `sql`, written with `?` placeholders like tx.exec, under
+// `name` (a valid sql identifier). returns `name`. meant for
+// namespace scope, before any connection is used.
+std::string register_statement(const std::string& name, const std::string& sql);
+
+// prepares every registered statement on `conn`, which has no open
+// transaction, for a pool that opens its connections itself. a
+// statement that fails to prepare fails the connection.
+void prepare_statements(pqxx::connection& conn);
+
+// returns the statement `name`. on a connection that was not passed
+// to prepare_statements (bserv's pool) the statements are prepared
+// in `tx` the first time the connection is seen, those already on
+// it are kept.
+const prepared_statement& get_statement(
+	bserv::db_transaction& tx,
+	const pqxx::connection& conn,
+	const std::string& name);
+
+// the same for a transaction of `conn` opened with pqxx.
+const prepared_statement& get_statement(
+	pqxx::transaction_base& tx,
+	const pqxx::connection& conn,
+	const std::string& name);
+
+// forgets that the statements were prepared on `conn`. to be called
+// before a pool closes a connection, since a connection opened later
+// may get the same address.
+void forget_statements(const pqxx::connection& conn);
+
+// adds what pg_stat_statements has counted since the last call to
+// `sql.<name>.plans` and `sql.<name>.plan_ns` (postgres fills them
+// with pg_stat_statements.track_planning on). false if the extension
+// is not installed.
+bool sample_statement_plans(pqxx::connection& conn);
+
+// runs the statement registered as `name`. the time spent is
+// reported as `sql.<name>.calls` and `sql.<name>.exec_ns`.
+template <typename ...Params>
+bserv::db_result exec_statement(
+	bserv::db_transaction& tx,
+	const std::shared_ptr<bserv::db_connection>& conn,
+	const std::string& name,
+	const Params&... params) {
+	const prepared_statement& statement = get_statement(tx, conn->get(), name);
+	auto start = std::chrono::steady_clock::now();
+	bserv::db_result result = tx.exec(statement.execute, params...);
+	statement.exec_ns->add((std::uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now() - start).count());
+	statement.calls->add();
+	return result;
+}
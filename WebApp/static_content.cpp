@@ -0,0 +1,112 @@
+#include "static_content.h"
+
+#include <unordered_map>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <cctype>
+
+#include <zlib.h>
+
+std::string mime_type(const std::string& path) {
+	static const std::unordered_map<std::string, std::string> types{
+		{ "htm", "text/html" },
+		{ "html", "text/html" },
+		{ "css", "text/css" },
+		{ "txt", "text/plain" },
+		{ "js", "application/javascript" },
+		{ "json", "application/json" },
+		{ "map", "application/json" },
+		{ "xml", "application/xml" },
+		{ "png", "image/png" },
+		{ "jpe", "image/jpeg" },
+		{ "jpeg", "image/jpeg" },
+		{ "jpg", "image/jpeg" },
+		{ "gif", "image/gif" },
+		{ "bmp", "image/bmp" },
+		{ "ico", "image/vnd.microsoft.icon" },
+		{ "svg", "image/svg+xml" },
+		{ "svgz", "image/svg+xml" },
+		{ "woff", "font/woff" },
+		{ "woff2", "font/woff2" },
+		{ "ttf", "font/ttf" },
+		{ "otf", "font/otf" },
+		{ "eot", "application/vnd.ms-fontobject" }
+	};
+	auto dot = path.rfind('.');
+	if (dot != std::string::npos) {
+		std::string ext = path.substr(dot + 1);
+		for (auto& c : ext)
+			c = (char)std::tolower((unsigned char)c);
+		auto it = types.find(ext);
+		if (it != types.end())
+			return it->second;
+	}
+	return "application/octet-stream";
+}
+
+bool is_compressible(const std::string& content_type) {
+	return content_type.compare(0, 5, "text/") == 0
+		|| content_type == "application/javascript"
+		|| content_type == "application/json"
+		|| content_type == "application/xml"
+		|| content_type == "image/svg+xml"
+		|| content_type == "image/vnd.microsoft.icon"
+		|| content_type == "font/ttf"
+		|| content_type == "font/otf"
+		|| content_type == "application/vnd.ms-fontobject";
+}
+
+std::string make_etag(const std::string& content) {
+	// FNV-1a over the whole content
+	std::uint64_t hash = 14695981039346656037ull;
+	for (unsigned char c : content) {
+		hash ^= c;
+		hash *= 1099511628211ull;
+	}
+	char buf[48];
+	std::snprintf(buf, sizeof(buf), "\"%zx-%016llx\"",
+		content.size(), (unsigned long long)hash);
+	return buf;
+}
+
+std::string gzip_etag(const std::string& etag) {
+	return etag.substr(0, etag.size() - 1) + "-gz\"";
+}
+
+std::string gzip_compress(const std::string& content, int level) {
+	z_stream stream{};
+	// 15 window bits + 16 writes a gzip header instead of zlib
+	if (deflateInit2(&stream, level, Z_DEFLATED,
+		15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK)
+		return {};
+	std::string out;
+	out.resize(deflateBound(&stream, (uLong)content.size()));
+	stream.next_in = (Bytef*)content.data();
+	stream.avail_in = (uInt)content.size();
+	stream.next_out = (Bytef*)out.data();
+	stream.avail_out = (uInt)out.size();
+	int res = deflate(&stream, Z_FINISH);
+	out.resize(stream.total_out);
+	deflateEnd(&stream);
+	if (res != Z_STREAM_END)
+		return {};
+	return out;
+}
+
+std::string gzip_variant(const std::string& content, const std::string& content_type) {
+	if (!is_compressible(content_type))
+		return {};
+	std::string gzip = gzip_compress(content, 9);
+	// not worth it for tiny or already dense files
+	if (gzip.size() >= content.size())
+		gzip.clear();
+	return gzip;
+}
+
+std::time_t file_mtime(const std::filesystem::path& path) {
+	auto ftime = std::filesystem::last_write_time(path);
+	auto stime = std::chrono::time_point_cast<std::chrono::system_clock::duration>(
+		ftime - std::filesystem::file_time_type::clock::now() + std::chrono::system_clock::now());
+	return std::chrono::system_clock::to_time_t(stime);
+}
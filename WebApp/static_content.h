@@ -0,0 +1,30 @@
+#pragma once
+
+#include <string>
+#include <ctime>
+#include <filesystem>
+
+// how a static file is described to clients: its type, etag and
+// gzip variant. shared by the static file cache and resource_packer,
+// so embedded files are answered like the ones read from disk.
+
+// the content type for the extension of `path`.
+std::string mime_type(const std::string& path);
+
+// text-like types that gzip makes smaller.
+bool is_compressible(const std::string& content_type);
+
+// a strong etag from the size and an FNV-1a hash of the content.
+std::string make_etag(const std::string& content);
+
+// the etag of the gzip variant of the content with `etag`.
+std::string gzip_etag(const std::string& etag);
+
+// gzip encodes `content` in one go. empty if compression fails.
+std::string gzip_compress(const std::string& content, int level);
+
+// the gzip variant served for `content` of `content_type`. empty if
+// the type is not compressible or gzip does not make it smaller.
+std::string gzip_variant(const std::string& content, const std::string& content_type);
+
+std::time_t file_mtime(const std::filesystem::path& path);
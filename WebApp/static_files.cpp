@@ -0,0 +1,521 @@
+#include "static_files.h"
+#include "static_content.h"
+#include "compression.h"
+#ifdef WEBAPP_EMBED_RESOURCES
+#include "embedded_resources.h"
+#endif
+
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+#include <unordered_map>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <ctime>
+#include <cstdio>
+#include <cstdint>
+#include <cctype>
+#include <cstdlib>
+#include <limits>
+
+#include <boost/beast.hpp>
+
+std::string static_root_;
+
+struct static_file {
+	std::string content;
+	std::string content_type;
+	std::string etag;
+	std::string last_modified;
+	std::time_t mtime;
+	// gzip encoded content, empty if the file is not compressible.
+	std::string gzip;
+	std::string gzip_etag;
+	// steady clock seconds of the last check against the disk.
+	mutable std::atomic<std::int64_t> checked{ 0 };
+
+	std::size_t bytes() const {
+		return content.size() + gzip.size();
+	}
+
+	// true for one caller once `static_check_interval` has passed
+	// since the last check, the others keep serving the file.
+	bool due_for_check() const {
+		std::int64_t now = std::chrono::duration_cast<std::chrono::seconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+		std::int64_t last = checked.load(std::memory_order_relaxed);
+		return now - last >= static_check_interval
+			&& checked.compare_exchange_strong(last, now, std::memory_order_relaxed);
+	}
+
+	static constexpr std::int64_t static_check_interval = 1;
+};
+
+// files kept in memory, least recently used first.
+class static_file_cache {
+public:
+	void set_capacity(std::size_t capacity) {
+		std::lock_guard<std::mutex> lock{ mutex_ };
+		capacity_ = capacity;
+		evict();
+	}
+
+	std::shared_ptr<const static_file> get(const std::string& name) {
+		std::lock_guard<std::mutex> lock{ mutex_ };
+		auto it = files_.find(name);
+		if (it == files_.end())
+			return nullptr;
+		order_.splice(order_.end(), order_, it->second.second);
+		return it->second.first;
+	}
+
+	// returns false if the file is larger than the whole cache.
+	bool put(const std::string& name, std::shared_ptr<const static_file> file) {
+		std::lock_guard<std::mutex> lock{ mutex_ };
+		if (file->bytes() > capacity_)
+			return false;
+		auto it = files_.find(name);
+		if (it != files_.end()) {
+			size_ -= it->second.first->bytes();
+			order_.erase(it->second.second);
+			files_.erase(it);
+		}
+		size_ += file->bytes();
+		files_.emplace(name, std::make_pair(std::move(file), order_.insert(order_.end(), name)));
+		evict();
+		return true;
+	}
+
+	void erase(const std::string& name) {
+		std::lock_guard<std::mutex> lock{ mutex_ };
+		auto it = files_.find(name);
+		if (it == files_.end())
+			return;
+		size_ -= it->second.first->bytes();
+		order_.erase(it->second.second);
+		files_.erase(it);
+	}
+
+private:
+	std::mutex mutex_;
+	std::size_t capacity_ = 0;
+	std::size_t size_ = 0;
+	std::list<std::string> order_;
+	std::unordered_map<std::string,
+		std::pair<std::shared_ptr<const static_file>, std::list<std::string>::iterator>> files_;
+
+	void evict() {
+		while (size_ > capacity_ && !order_.empty()) {
+			auto it = files_.find(order_.front());
+			size_ -= it->second.first->bytes();
+			files_.erase(it);
+			order_.pop_front();
+		}
+	}
+};
+
+static_file_cache static_cache_;
+std::string cache_control_;
+// files larger than this are never cached, each request reads
+// just the bytes it asks for from disk into the body. that is one
+// copy in user space: a file_body or sendfile response would need
+// bserv to let handlers choose the body type and write the socket,
+// its handlers fill a string_body that bserv sends after they return.
+std::uint64_t large_file_size_ = 1024 * 1024;
+
+// rejects absolute paths and any `..` component.
+bool is_safe_path(const std::string& file) {
+	if (file.empty() || file[0] == '/' || file[0] == '\\'
+		|| file.find('\0') != std::string::npos
+		|| file.find(':') != std::string::npos)
+		return false;
+	std::size_t begin = 0;
+	while (begin <= file.size()) {
+		std::size_t end = file.find_first_of("/\\", begin);
+		if (end == std::string::npos) end = file.size();
+		if (file.compare(begin, end - begin, "..") == 0)
+			return false;
+		begin = end + 1;
+	}
+	return true;
+}
+
+std::string http_date(std::time_t t) {
+	std::tm tm{};
+#ifdef _WIN32
+	gmtime_s(&tm, &t);
+#else
+	gmtime_r(&t, &tm);
+#endif
+	char buf[64];
+	std::strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+	return buf;
+}
+
+// parses an IMF-fixdate ("Sun, 06 Nov 1994 08:49:37 GMT").
+std::optional<std::time_t> parse_http_date(const std::string& date) {
+	static const char* months[] = {
+		"Jan", "Feb", "Mar", "Apr", "May", "Jun",
+		"Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+	char weekday[4], month[4];
+	int day, year, hour, minute, second;
+	if (std::sscanf(date.c_str(), "%3s, %d %3s %d %d:%d:%d GMT",
+		weekday, &day, month, &year, &hour, &minute, &second) != 7)
+		return std::nullopt;
+	int m = 0;
+	while (m < 12 && std::string{ months[m] } != month) ++m;
+	if (m == 12)
+		return std::nullopt;
+	// days since 1970-01-01 (Howard Hinnant's days_from_civil)
+	int y = year - (m < 2);
+	int era = (y >= 0 ? y : y - 399) / 400;
+	unsigned yoe = (unsigned)(y - era * 400);
+	unsigned mp = (unsigned)(m + (m > 1 ? -2 : 10));
+	unsigned doy = (153 * mp + 2) / 5 + (unsigned)day - 1;
+	unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+	std::int64_t days = (std::int64_t)era * 146097 + (std::int64_t)doe - 719468;
+	return (std::time_t)(days * 86400 + hour * 3600 + minute * 60 + second);
+}
+
+std::shared_ptr<static_file> load_static_file(const std::string& name) {
+	std::filesystem::path path{ static_root_ + name };
+	std::error_code ec;
+	if (!std::filesystem::is_regular_file(path, ec))
+		return nullptr;
+	std::ifstream in{ path, std::ios::binary };
+	if (!in)
+		return nullptr;
+	auto file = std::make_shared<static_file>();
+	std::ostringstream os;
+	os << in.rdbuf();
+	file->content = os.str();
+	file->content_type = mime_type(name);
+	file->etag = make_etag(file->content);
+	file->mtime = file_mtime(path);
+	file->last_modified = http_date(file->mtime);
+	file->gzip = gzip_variant(file->content, file->content_type);
+	if (!file->gzip.empty())
+		file->gzip_etag = gzip_etag(file->etag);
+	return file;
+}
+
+#ifdef WEBAPP_EMBED_RESOURCES
+std::shared_ptr<static_file> load_embedded_file(const embedded_resource& resource) {
+	auto file = std::make_shared<static_file>();
+	file->content.assign((const char*)resource.data, resource.size);
+	file->content_type = mime_type(resource.name);
+	file->etag = resource.etag;
+	file->mtime = resource.mtime;
+	file->last_modified = http_date(file->mtime);
+	if (resource.gzip != nullptr) {
+		file->gzip.assign((const char*)resource.gzip, resource.gzip_size);
+		file->gzip_etag = gzip_etag(file->etag);
+	}
+	return file;
+}
+#endif
+
+void init_static_root(
+	const std::string& static_root,
+	std::size_t cache_size,
+	int max_age,
+	std::size_t large_file_size) {
+	static_root_ = static_root;
+	if (static_root_[static_root_.size() - 1] != '/')
+		static_root_.push_back('/');
+	cache_control_ = "public, max-age=" + std::to_string(max_age);
+	large_file_size_ = large_file_size;
+	static_cache_.set_capacity(cache_size);
+
+#ifdef WEBAPP_EMBED_RESOURCES
+	// every file is in the binary: nothing is evicted and
+	// the static root is never read.
+	static_cache_.set_capacity(std::numeric_limits<std::size_t>::max());
+	large_file_size_ = std::numeric_limits<std::uint64_t>::max();
+	std::size_t count = 0;
+	const embedded_resource* resources = embedded_statics(count);
+	std::size_t embedded = 0;
+	for (std::size_t i = 0; i < count; ++i) {
+		auto file = load_embedded_file(resources[i]);
+		embedded += file->bytes();
+		static_cache_.put(resources[i].name, std::move(file));
+	}
+	lginfo << "static files embedded: " << embedded / 1024 << " KiB" << std::endl;
+	return;
+#endif
+
+	std::size_t loaded = 0;
+	for (const auto& entry : std::filesystem::recursive_directory_iterator(static_root_)) {
+		if (!entry.is_regular_file())
+			continue;
+		if (entry.file_size() > large_file_size_
+			|| loaded + entry.file_size() > cache_size)
+			continue;
+		std::string name = std::filesystem::relative(entry.path(), static_root_).generic_string();
+		auto file = load_static_file(name);
+		if (file && static_cache_.put(name, file))
+			loaded += file->bytes();
+	}
+	lginfo << "static files cached: " << loaded / 1024 << " KiB" << std::endl;
+}
+
+void invalidate_static_file(const std::string& file) {
+	static_cache_.erase(file);
+}
+
+// false if the file on disk is gone or differs in mtime or size
+// from the cached copy.
+bool is_current(const std::string& file, const static_file& cached) {
+	std::filesystem::path path{ static_root_ + file };
+	std::error_code ec;
+	if (!std::filesystem::is_regular_file(path, ec))
+		return false;
+	std::uint64_t size = std::filesystem::file_size(path, ec);
+	return !ec && size == cached.content.size() && file_mtime(path) == cached.mtime;
+}
+
+bool etag_matches(const std::string& header, const std::string& etag) {
+	// weak comparison, as required for If-None-Match
+	std::size_t pos = 0;
+	while (pos < header.size()) {
+		std::size_t end = header.find(',', pos);
+		if (end == std::string::npos) end = header.size();
+		std::string tag = header.substr(pos, end - pos);
+		auto first = tag.find_first_not_of(" \t");
+		auto last = tag.find_last_not_of(" \t");
+		tag = first == std::string::npos ? "" : tag.substr(first, last - first + 1);
+		if (tag.compare(0, 2, "W/") == 0)
+			tag.erase(0, 2);
+		if (tag == "*" || tag == etag)
+			return true;
+		pos = end + 1;
+	}
+	return false;
+}
+
+bool not_modified(
+	const bserv::request_type& request,
+	std::time_t mtime,
+	const std::string& etag) {
+	auto if_none_match = request.find(bserv::http::field::if_none_match);
+	if (if_none_match != request.end())
+		return etag_matches(std::string{ if_none_match->value() }, etag);
+	auto if_modified_since = request.find(bserv::http::field::if_modified_since);
+	if (if_modified_since != request.end()) {
+		auto since = parse_http_date(std::string{ if_modified_since->value() });
+		return since.has_value() && mtime <= *since;
+	}
+	return false;
+}
+
+enum class range_result { full, partial, unsatisfiable };
+
+// matches the `Range` header against a representation of `size`
+// bytes. only a single byte range is supported, anything else
+// gets the full content.
+range_result parse_range(
+	const bserv::request_type& request,
+	const std::string& etag,
+	const std::string& last_modified,
+	std::uint64_t size,
+	std::uint64_t& first,
+	std::uint64_t& last) {
+	auto range = request.find(bserv::http::field::range);
+	if (range == request.end())
+		return range_result::full;
+	// a stale If-Range means the client's partial copy is useless
+	auto if_range = request.find(bserv::http::field::if_range);
+	if (if_range != request.end()) {
+		std::string validator{ if_range->value() };
+		if (validator != etag && validator != last_modified)
+			return range_result::full;
+	}
+	std::string value{ range->value() };
+	if (value.compare(0, 6, "bytes=") != 0
+		|| value.find(',') != std::string::npos)
+		return range_result::full;
+	value.erase(0, 6);
+	std::size_t dash = value.find('-');
+	if (dash == std::string::npos)
+		return range_result::full;
+	std::string from = value.substr(0, dash);
+	std::string to = value.substr(dash + 1);
+	auto is_number = [](const std::string& str) {
+		return !str.empty() && str.size() < 20
+			&& str.find_first_not_of("0123456789") == std::string::npos;
+	};
+	if (from.empty()) {
+		// suffix range: the last `to` bytes
+		if (!is_number(to))
+			return range_result::full;
+		std::uint64_t length = std::stoull(to);
+		if (length == 0 || size == 0)
+			return range_result::unsatisfiable;
+		first = length < size ? size - length : 0;
+		last = size - 1;
+		return range_result::partial;
+	}
+	if (!is_number(from) || (!to.empty() && !is_number(to)))
+		return range_result::full;
+	first = std::stoull(from);
+	last = to.empty() ? first : std::stoull(to);
+	if (last < first)
+		return range_result::full;
+	if (first >= size)
+		return range_result::unsatisfiable;
+	if (to.empty())
+		last = size - 1;
+	if (last >= size)
+		last = size - 1;
+	return range_result::partial;
+}
+
+void set_validators(
+	bserv::response_type& response,
+	const std::string& etag,
+	const std::string& last_modified) {
+	response.set(bserv::http::field::etag, etag);
+	response.set(bserv::http::field::last_modified, last_modified);
+	response.set(bserv::http::field::cache_control, cache_control_);
+	response.set(bserv::http::field::accept_ranges, "bytes");
+}
+
+void set_not_modified(bserv::response_type& response) {
+	response.result(bserv::http::status::not_modified);
+	response.body().clear();
+	response.prepare_payload();
+}
+
+void set_unsatisfiable(bserv::response_type& response, std::uint64_t size) {
+	response.result(bserv::http::status::range_not_satisfiable);
+	response.set(bserv::http::field::content_range, "bytes */" + std::to_string(size));
+	response.body().clear();
+	response.prepare_payload();
+}
+
+void set_partial(
+	bserv::response_type& response,
+	std::uint64_t first,
+	std::uint64_t last,
+	std::uint64_t size) {
+	response.result(bserv::http::status::partial_content);
+	response.set(bserv::http::field::content_range,
+		"bytes " + std::to_string(first) + "-" + std::to_string(last)
+		+ "/" + std::to_string(size));
+}
+
+// serves a file that is too large for the cache. the etag is
+// derived from size and mtime so the file is never read whole,
+// and only the requested range is read into the string body.
+std::nullopt_t serve_large_file(
+	const bserv::request_type& request,
+	bserv::response_type& response,
+	const std::string& file,
+	const std::filesystem::path& path,
+	std::uint64_t size) {
+	std::time_t mtime = file_mtime(path);
+	char etag[48];
+	std::snprintf(etag, sizeof(etag), "\"%llx-%llx\"",
+		(unsigned long long)size, (unsigned long long)mtime);
+	std::string last_modified = http_date(mtime);
+	set_validators(response, etag, last_modified);
+	if (not_modified(request, mtime, etag)) {
+		set_not_modified(response);
+		return std::nullopt;
+	}
+	std::uint64_t first = 0, last = size - 1;
+	switch (parse_range(request, etag, last_modified, size, first, last)) {
+	case range_result::unsatisfiable:
+		set_unsatisfiable(response, size);
+		return std::nullopt;
+	case range_result::partial:
+		set_partial(response, first, last, size);
+		break;
+	case range_result::full:
+		break;
+	}
+	std::ifstream in{ path, std::ios::binary };
+	if (!in)
+		throw bserv::url_not_found_exception{};
+	response.set(bserv::http::field::content_type, mime_type(file));
+	std::string& body = response.body();
+	body.resize((std::size_t)(last - first + 1));
+	in.seekg((std::streamoff)first);
+	in.read(body.data(), (std::streamsize)body.size());
+	body.resize((std::size_t)in.gcount());
+	response.prepare_payload();
+	return std::nullopt;
+}
+
+std::nullopt_t serve(
+	const bserv::request_type& request,
+	bserv::response_type& response,
+	const std::string& file) {
+	if (!is_safe_path(file))
+		throw bserv::url_not_found_exception{};
+	std::shared_ptr<const static_file> cached = static_cache_.get(file);
+#ifdef WEBAPP_EMBED_RESOURCES
+	// generated files (image variants) are still kept on disk
+	if (cached == nullptr && file.compare(0, 7, "thumbs/") != 0)
+		throw bserv::url_not_found_exception{};
+#else
+	// files edited in place are picked up within a second, the
+	// cached copy is compared with the disk at most that often.
+	if (cached != nullptr && cached->due_for_check() && !is_current(file, *cached)) {
+		static_cache_.erase(file);
+		cached = nullptr;
+	}
+#endif
+	if (cached == nullptr) {
+		std::filesystem::path path{ static_root_ + file };
+		std::error_code ec;
+		if (!std::filesystem::is_regular_file(path, ec))
+			throw bserv::url_not_found_exception{};
+		std::uint64_t size = std::filesystem::file_size(path, ec);
+		if (!ec && size > large_file_size_)
+			return serve_large_file(request, response, file, path, size);
+		auto loaded = load_static_file(file);
+		if (loaded == nullptr)
+			throw bserv::url_not_found_exception{};
+		static_cache_.put(file, loaded);
+		cached = loaded;
+	}
+	// each encoding is a separate representation with its own etag.
+	// ranges are only served from the identity encoding.
+	bool ranged = request.find(bserv::http::field::range) != request.end();
+	bool gzip = !cached->gzip.empty() && !ranged && accepts_gzip(request);
+	const std::string& etag = gzip ? cached->gzip_etag : cached->etag;
+	set_validators(response, etag, cached->last_modified);
+	if (!cached->gzip.empty())
+		response.set(bserv::http::field::vary, "Accept-Encoding");
+	if (not_modified(request, cached->mtime, etag)) {
+		set_not_modified(response);
+		return std::nullopt;
+	}
+	response.set(bserv::http::field::content_type, cached->content_type);
+	if (gzip) {
+		response.set(bserv::http::field::content_encoding, "gzip");
+		response.body() = cached->gzip;
+		response.prepare_payload();
+		return std::nullopt;
+	}
+	const std::string& content = cached->content;
+	std::uint64_t first = 0, last = 0;
+	switch (parse_range(request, etag, cached->last_modified, content.size(), first, last)) {
+	case range_result::unsatisfiable:
+		set_unsatisfiable(response, content.size());
+		return std::nullopt;
+	case range_result::partial:
+		set_partial(response, first, last, content.size());
+		response.body().assign(content, (std::size_t)first, (std::size_t)(last - first + 1));
+		break;
+	case range_result::full:
+		response.body() = content;
+		break;
+	}
+	response.prepare_payload();
+	return std::nullopt;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <string>
+#include <optional>
+
+#include "bserv/common.hpp"
+
+// loads the files under `static_root` into memory, up to
+// `cache_size` bytes. files that do not fit are read on demand
+// and kept in the cache in least-recently-used order. text
+// files are also kept gzip compressed. a cached file is compared
+// with the disk (mtime and size) at most once a second, so files
+// changed under the static root are reloaded. files over
+// `large_file_size` ("static-large-file-size") are never cached,
+// each request reads only its range from disk into the response
+// body. they are not sent zero copy: bserv responses are
+// string_body, written by bserv after the handler returns.
+void init_static_root(
+	const std::string& static_root,
+	std::size_t cache_size = 64 * 1024 * 1024,
+	int max_age = 3600,
+	std::size_t large_file_size = 1024 * 1024);
+
+// serves `file` (relative to the static root) with an ETag and
+// Last-Modified, answering conditional requests with 304.
+// the gzip variant is sent to clients that accept it, and single
+// byte ranges are answered with 206.
+std::nullopt_t serve(
+	const bserv::request_type& request,
+	bserv::response_type& response,
+	const std::string& file);
+
+// false for absolute paths and paths with a `..` component.
+bool is_safe_path(const std::string& file);
+
+// drops `file` from the cache after it changed on disk.
+void invalidate_static_file(const std::string& file);
@@ -0,0 +1,638 @@
+// template_compiler: turns the inja templates of a directory into C++
+// render functions, see `compiled_templates.h`.
+//
+// usage: template_compiler <template_root> <output.cpp>
+//
+// only the subset of inja used by our templates is supported:
+// `{{ path }}`, `{% for x in path %}`, `{% if cond %}` / `{% else if cond %}` /
+// `{% else %}`, `{% block %}`, `{% extends %}` and comments, where a
+// value is a path or `at(path, loop.index)`, and a condition is a
+// value, `exists("name")`, `existsIn(path, "key")` or `not cond`.
+// a template using anything else is skipped, and is then rendered
+// by inja at runtime.
+//
+// the generated code does not look variables up by key per use: the
+// paths into the context are resolved once at the top of the render
+// function, and the members of a loop variable are read at the
+// position they have in the first row of the array.
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <algorithm>
+#include <cstdlib>
+#include <cstdio>
+#include <cctype>
+
+struct unsupported_template : std::runtime_error {
+	using std::runtime_error::runtime_error;
+};
+
+struct node {
+	enum class type { text, print, for_loop, if_chain, block, extends };
+	type kind;
+	// text: the literal text; print: the expression;
+	// for_loop: the loop variable; block/extends: the name
+	std::string value;
+	// for_loop: the iterated expression
+	std::string expression;
+	// for_loop/block: the body
+	std::vector<std::shared_ptr<node>> children;
+	// if_chain: (condition, body) pairs; an empty condition is `else`
+	std::vector<std::pair<std::string, std::vector<std::shared_ptr<node>>>> branches;
+};
+
+using node_list = std::vector<std::shared_ptr<node>>;
+
+std::string trim(const std::string& s) {
+	auto begin = s.find_first_not_of(" \t\r\n");
+	if (begin == std::string::npos) return "";
+	auto end = s.find_last_not_of(" \t\r\n");
+	return s.substr(begin, end - begin + 1);
+}
+
+bool starts_with(const std::string& s, const std::string& prefix) {
+	return s.compare(0, prefix.size(), prefix) == 0;
+}
+
+std::string unquote(const std::string& s) {
+	std::string t = trim(s);
+	if (t.size() < 2 || t.front() != '"' || t.back() != '"')
+		throw unsupported_template{ "expected a string literal: " + s };
+	return t.substr(1, t.size() - 2);
+}
+
+struct token {
+	enum class type { text, expression, statement };
+	type kind;
+	std::string content;
+};
+
+std::vector<token> tokenize(const std::string& input) {
+	std::vector<token> tokens;
+	std::size_t pos = 0;
+	while (pos < input.size()) {
+		std::size_t open = input.find('{', pos);
+		while (open != std::string::npos && open + 1 < input.size()
+			&& input[open + 1] != '{' && input[open + 1] != '%' && input[open + 1] != '#')
+			open = input.find('{', open + 1);
+		if (open == std::string::npos || open + 1 >= input.size()) {
+			tokens.push_back({ token::type::text, input.substr(pos) });
+			break;
+		}
+		if (open > pos)
+			tokens.push_back({ token::type::text, input.substr(pos, open - pos) });
+		char opener = input[open + 1];
+		std::string closer = opener == '{' ? "}}" : opener == '%' ? "%}" : "#}";
+		std::size_t close = input.find(closer, open + 2);
+		if (close == std::string::npos)
+			throw unsupported_template{ "unterminated tag" };
+		std::string content = input.substr(open + 2, close - open - 2);
+		if (!content.empty() && (content.front() == '-' || content.back() == '-'))
+			throw unsupported_template{ "whitespace control is not supported" };
+		if (opener == '{')
+			tokens.push_back({ token::type::expression, trim(content) });
+		else if (opener == '%')
+			tokens.push_back({ token::type::statement, trim(content) });
+		pos = close + 2;
+	}
+	return tokens;
+}
+
+class parser {
+public:
+	explicit parser(std::vector<token> tokens) : tokens_{ std::move(tokens) } {}
+
+	node_list parse() {
+		std::string end;
+		node_list nodes = parse_until({}, end);
+		if (pos_ != tokens_.size())
+			throw unsupported_template{ "unexpected `" + end + "`" };
+		return nodes;
+	}
+
+private:
+	std::vector<token> tokens_;
+	std::size_t pos_ = 0;
+
+	// parses nodes until one of the statements in `ends` (matched by
+	// prefix), which is consumed and returned through `end`.
+	node_list parse_until(const std::vector<std::string>& ends, std::string& end) {
+		node_list nodes;
+		while (pos_ < tokens_.size()) {
+			const token& tok = tokens_[pos_++];
+			if (tok.kind == token::type::text) {
+				auto n = std::make_shared<node>();
+				n->kind = node::type::text;
+				n->value = tok.content;
+				nodes.push_back(n);
+				continue;
+			}
+			if (tok.kind == token::type::expression) {
+				auto n = std::make_shared<node>();
+				n->kind = node::type::print;
+				n->value = tok.content;
+				nodes.push_back(n);
+				continue;
+			}
+			const std::string& stmt = tok.content;
+			for (const auto& e : ends) {
+				if (stmt == e || starts_with(stmt, e + " ")) {
+					end = stmt;
+					return nodes;
+				}
+			}
+			if (starts_with(stmt, "for ")) {
+				std::istringstream is{ stmt.substr(4) };
+				std::string var, in, expression;
+				is >> var >> in;
+				std::getline(is, expression);
+				if (in != "in" || var.find(',') != std::string::npos)
+					throw unsupported_template{ "unsupported loop: " + stmt };
+				auto n = std::make_shared<node>();
+				n->kind = node::type::for_loop;
+				n->value = var;
+				n->expression = trim(expression);
+				std::string inner_end;
+				n->children = parse_until({ "endfor" }, inner_end);
+				if (inner_end.empty())
+					throw unsupported_template{ "missing endfor" };
+				nodes.push_back(n);
+			}
+			else if (starts_with(stmt, "if ")) {
+				auto n = std::make_shared<node>();
+				n->kind = node::type::if_chain;
+				std::string condition = trim(stmt.substr(3));
+				while (true) {
+					std::string inner_end;
+					node_list body = parse_until({ "else", "endif" }, inner_end);
+					n->branches.emplace_back(condition, std::move(body));
+					if (inner_end == "endif")
+						break;
+					if (inner_end == "else") {
+						condition = "";
+						std::string final_end;
+						node_list else_body = parse_until({ "endif" }, final_end);
+						if (final_end.empty())
+							throw unsupported_template{ "missing endif" };
+						n->branches.emplace_back(condition, std::move(else_body));
+						break;
+					}
+					if (starts_with(inner_end, "else if ")) {
+						condition = trim(inner_end.substr(8));
+						continue;
+					}
+					throw unsupported_template{ "missing endif" };
+				}
+				nodes.push_back(n);
+			}
+			else if (starts_with(stmt, "block ")) {
+				auto n = std::make_shared<node>();
+				n->kind = node::type::block;
+				n->value = trim(stmt.substr(6));
+				std::string inner_end;
+				n->children = parse_until({ "endblock" }, inner_end);
+				if (inner_end.empty())
+					throw unsupported_template{ "missing endblock" };
+				nodes.push_back(n);
+			}
+			else if (starts_with(stmt, "extends ")) {
+				auto n = std::make_shared<node>();
+				n->kind = node::type::extends;
+				n->value = unquote(stmt.substr(8));
+				nodes.push_back(n);
+			}
+			else {
+				throw unsupported_template{ "unsupported statement: " + stmt };
+			}
+		}
+		end.clear();
+		if (!ends.empty())
+			throw unsupported_template{ "unexpected end of template" };
+		return nodes;
+	}
+};
+
+std::string read_file(const std::filesystem::path& path) {
+	std::ifstream file{ path, std::ios::binary };
+	if (!file)
+		throw unsupported_template{ "cannot read " + path.string() };
+	std::ostringstream os;
+	os << file.rdbuf();
+	return os.str();
+}
+
+void collect_blocks(const node_list& nodes, std::map<std::string, std::shared_ptr<node>>& blocks) {
+	for (const auto& n : nodes) {
+		if (n->kind == node::type::block) {
+			// the most derived template wins, and it is visited first
+			blocks.emplace(n->value, n);
+			collect_blocks(n->children, blocks);
+		}
+		else if (n->kind == node::type::for_loop) {
+			collect_blocks(n->children, blocks);
+		}
+		else if (n->kind == node::type::if_chain) {
+			for (const auto& branch : n->branches)
+				collect_blocks(branch.second, blocks);
+		}
+	}
+}
+
+// inlines `{% extends %}`: the result is the node list inja would
+// render, with blocks resolved through `blocks`.
+node_list resolve(
+	const std::filesystem::path& root,
+	const std::string& name,
+	std::map<std::string, std::shared_ptr<node>>& blocks,
+	int depth = 0) {
+	if (depth > 16)
+		throw unsupported_template{ "extends nested too deeply" };
+	node_list nodes = parser{ tokenize(read_file(root / name)) }.parse();
+	collect_blocks(nodes, blocks);
+	node_list result;
+	for (const auto& n : nodes) {
+		if (n->kind == node::type::extends) {
+			// inja stops rendering the child at `extends`
+			node_list parent = resolve(root, n->value, blocks, depth + 1);
+			result.insert(result.end(), parent.begin(), parent.end());
+			return result;
+		}
+		result.push_back(n);
+	}
+	return result;
+}
+
+class generator {
+public:
+	generator(std::map<std::string, std::shared_ptr<node>> blocks)
+		: blocks_{ std::move(blocks) } {}
+
+	std::string generate(const node_list& nodes) {
+		emit_nodes(nodes, 1);
+		return pointers_code_ + code_.str();
+	}
+
+private:
+	struct loop_scope {
+		std::string var;
+		int id;
+		// the first row, the members' positions are taken from it
+		std::string first;
+		// path (from the loop variable) -> its position, and the
+		// value at that path in the first row
+		std::map<std::string, std::string> positions;
+		std::map<std::string, std::string> rows;
+		// declared before the loop
+		std::string code;
+	};
+
+	std::map<std::string, std::shared_ptr<node>> blocks_;
+	std::vector<loop_scope> loops_;
+	std::ostringstream code_;
+	int next_id_ = 0;
+	int next_var_ = 0;
+	// the values the context paths resolve to, found once at the top
+	// of the function: path -> `const boost::json::value*`.
+	std::map<std::string, std::string> pointers_;
+	std::string pointers_code_;
+
+	static std::string indent(int level) {
+		return std::string(level, '\t');
+	}
+
+	// `s` as a std::string_view, sized at compile time.
+	static std::string key(const std::string& s) {
+		return "{ " + literal(s) + ", " + std::to_string(s.size()) + " }";
+	}
+
+	std::string new_var(const char* prefix) {
+		return prefix + std::to_string(next_var_++);
+	}
+
+	static std::string join(const std::vector<std::string>& parts, std::size_t n) {
+		std::string path = parts[0];
+		for (std::size_t i = 1; i < n; ++i)
+			path += "." + parts[i];
+		return path;
+	}
+
+	// the variable holding the value at context path `parts[0, n)`,
+	// null if it does not exist.
+	std::string pointer(const std::vector<std::string>& parts, std::size_t n) {
+		std::string path = join(parts, n);
+		auto it = pointers_.find(path);
+		if (it != pointers_.end())
+			return it->second;
+		std::string parent = n == 1 ? "context" : pointer(parts, n - 1);
+		std::string var = new_var("c_");
+		pointers_code_ += indent(1) + "const boost::json::value* " + var
+			+ " = compiled::find(" + parent + ", " + key(parts[n - 1]) + ");\n";
+		pointers_.emplace(path, var);
+		return var;
+	}
+
+	// the variable holding the position of the member at path
+	// `parts[0, n)` of the loop variable, as found in the first row.
+	std::string position(loop_scope& scope, const std::vector<std::string>& parts, std::size_t n) {
+		std::string path = join(parts, n);
+		auto it = scope.positions.find(path);
+		if (it != scope.positions.end())
+			return it->second;
+		std::string parent = n == 2 ? scope.first : row(scope, parts, n - 1);
+		std::string var = new_var("p_");
+		scope.code += "const std::size_t " + var + " = compiled::position("
+			+ parent + ", " + key(parts[n - 1]) + ");\n";
+		scope.positions.emplace(path, var);
+		return var;
+	}
+
+	// the value at path `parts[0, n)` (n >= 2) of the first row.
+	std::string row(loop_scope& scope, const std::vector<std::string>& parts, std::size_t n) {
+		std::string path = join(parts, n);
+		auto it = scope.rows.find(path);
+		if (it != scope.rows.end())
+			return it->second;
+		std::string pos = position(scope, parts, n);
+		std::string parent = n == 2 ? scope.first : row(scope, parts, n - 1);
+		std::string var = new_var("r_");
+		scope.code += "const boost::json::value* " + var + " = compiled::child("
+			+ parent + ", " + pos + ");\n";
+		scope.rows.emplace(path, var);
+		return var;
+	}
+
+	static std::string literal(const std::string& s) {
+		std::string out = "\"";
+		for (unsigned char c : s) {
+			switch (c) {
+			case '\n': out += "\\n\"\n\t\t\""; break;
+			case '\r': out += "\\r"; break;
+			case '\t': out += "\\t"; break;
+			case '"': out += "\\\""; break;
+			case '\\': out += "\\\\"; break;
+			case '?': out += "\\?"; break;
+			default:
+				if (c < 0x20 || c >= 0x7f) {
+					// octal escapes never swallow the following characters
+					char buf[8];
+					std::snprintf(buf, sizeof(buf), "\\%03o", c);
+					out += buf;
+				}
+				else {
+					out += static_cast<char>(c);
+				}
+			}
+		}
+		return out + "\"";
+	}
+
+	static std::vector<std::string> split_path(const std::string& path) {
+		std::vector<std::string> parts;
+		std::string part;
+		for (char c : path) {
+			if (c == '.') {
+				parts.push_back(part);
+				part.clear();
+			}
+			else if (std::isalnum(static_cast<unsigned char>(c)) || c == '_') {
+				part += c;
+			}
+			else {
+				throw unsupported_template{ "unsupported expression: " + path };
+			}
+		}
+		parts.push_back(part);
+		for (const auto& p : parts)
+			if (p.empty())
+				throw unsupported_template{ "unsupported expression: " + path };
+		return parts;
+	}
+
+	loop_scope* find_loop(const std::string& var) {
+		for (auto it = loops_.rbegin(); it != loops_.rend(); ++it)
+			if (it->var == var)
+				return &*it;
+		return nullptr;
+	}
+
+	// a C++ expression for `path`: either a `const boost::json::value&`
+	// (`is_json`) or a plain number/bool for the `loop` object. no key
+	// is looked up here: context paths were resolved at the top of the
+	// function, and the members of a loop variable are read at their
+	// position in the first row.
+	std::string value_of(const std::string& path, bool& is_json) {
+		std::string p = trim(path);
+		if (starts_with(p, "at(") && p.back() == ')') {
+			std::string args = p.substr(3, p.size() - 4);
+			auto comma = args.find(',');
+			if (comma == std::string::npos)
+				throw unsupported_template{ "unsupported expression: " + path };
+			bool array_is_json, index_is_json;
+			std::string array = value_of(args.substr(0, comma), array_is_json);
+			std::string index = value_of(args.substr(comma + 1), index_is_json);
+			// only loop.index and friends, which are numbers here
+			if (!array_is_json || index_is_json)
+				throw unsupported_template{ "unsupported expression: " + path };
+			is_json = true;
+			return "compiled::at(" + array + ", " + index + ", " + literal(trim(args.substr(0, comma))) + ")";
+		}
+		std::vector<std::string> parts = split_path(p);
+		is_json = true;
+		if (loop_scope* scope = find_loop(parts[0])) {
+			std::string expr = "v_" + std::to_string(scope->id);
+			for (std::size_t i = 1; i < parts.size(); ++i)
+				expr = "compiled::member(" + expr + ", " + position(*scope, parts, i + 1) + ", "
+					+ key(parts[i]) + ", " + literal(join(parts, i + 1)) + ")";
+			return expr;
+		}
+		if (parts[0] == "loop" && !loops_.empty()) {
+			if (parts.size() != 2)
+				throw unsupported_template{ "unsupported expression: " + path };
+			std::string i = "i_" + std::to_string(loops_.back().id);
+			std::string n = "a_" + std::to_string(loops_.back().id) + ".size()";
+			is_json = false;
+			if (parts[1] == "index") return "static_cast<std::int64_t>(" + i + ")";
+			if (parts[1] == "index1") return "static_cast<std::int64_t>(" + i + " + 1)";
+			if (parts[1] == "is_first") return "(" + i + " == 0)";
+			if (parts[1] == "is_last") return "(" + i + " + 1 == " + n + ")";
+			throw unsupported_template{ "unsupported expression: " + path };
+		}
+		return "compiled::deref(" + pointer(parts, parts.size()) + ", " + literal(p) + ")";
+	}
+
+	std::string condition(const std::string& cond) {
+		std::string c = trim(cond);
+		if (starts_with(c, "not "))
+			return "!(" + condition(c.substr(4)) + ")";
+		if (starts_with(c, "exists(") && c.back() == ')') {
+			// relative to the context, whatever the loops are called
+			std::vector<std::string> parts = split_path(unquote(c.substr(7, c.size() - 8)));
+			return "(" + pointer(parts, parts.size()) + " != nullptr)";
+		}
+		if (starts_with(c, "existsIn(") && c.back() == ')') {
+			std::string args = c.substr(9, c.size() - 10);
+			auto comma = args.find(',');
+			if (comma == std::string::npos)
+				throw unsupported_template{ "unsupported condition: " + cond };
+			std::string object = trim(args.substr(0, comma));
+			std::vector<std::string> parts = split_path(object);
+			parts.push_back(unquote(args.substr(comma + 1)));
+			loop_scope* scope = find_loop(parts[0]);
+			if (scope == nullptr && parts[0] == "loop" && !loops_.empty())
+				throw unsupported_template{ "unsupported condition: " + cond };
+			if (scope == nullptr)
+				return "compiled::exists_in(" + pointer(parts, parts.size() - 1) + ", "
+					+ pointer(parts, parts.size()) + ", " + literal(object) + ")";
+			bool is_json;
+			std::string value = value_of(object, is_json);
+			return "compiled::exists_in(" + value + ", " + position(*scope, parts, parts.size())
+				+ ", " + key(parts.back()) + ")";
+		}
+		bool is_json;
+		std::string value = value_of(c, is_json);
+		return is_json ? "compiled::truthy(" + value + ")" : "static_cast<bool>(" + value + ")";
+	}
+
+	void emit_nodes(const node_list& nodes, int level) {
+		for (const auto& n : nodes)
+			emit_node(*n, level);
+	}
+
+	void emit_node(const node& n, int level) {
+		switch (n.kind) {
+		case node::type::text:
+			if (!n.value.empty())
+				code_ << indent(level) << "out.append(" << literal(n.value)
+					<< ", " << n.value.size() << ");\n";
+			break;
+		case node::type::print: {
+			bool is_json;
+			std::string value = value_of(n.value, is_json);
+			code_ << indent(level) << "compiled::write(out, " << value << ");\n";
+			break;
+		}
+		case node::type::for_loop: {
+			int id = next_id_++;
+			bool is_json;
+			std::string array = value_of(n.expression, is_json);
+			if (!is_json)
+				throw unsupported_template{ "unsupported loop: " + n.expression };
+			std::string a = "a_" + std::to_string(id);
+			std::string i = "i_" + std::to_string(id);
+			loops_.push_back({ n.value, id, new_var("r_") });
+			std::ostringstream body;
+			std::swap(code_, body);
+			emit_nodes(n.children, level + 2);
+			std::swap(code_, body);
+			loop_scope scope = std::move(loops_.back());
+			loops_.pop_back();
+			code_ << indent(level) << "{\n"
+				<< indent(level + 1) << "const boost::json::array& " << a
+				<< " = compiled::as_array(" << array << ", " << literal(n.expression) << ");\n";
+			if (!scope.code.empty()) {
+				code_ << indent(level + 1) << "const boost::json::value* " << scope.first
+					<< " = compiled::first(" << a << ");\n";
+				std::istringstream lines{ scope.code };
+				for (std::string line; std::getline(lines, line);)
+					code_ << indent(level + 1) << line << "\n";
+			}
+			code_ << indent(level + 1) << "for (std::size_t " << i << " = 0; " << i << " < "
+				<< a << ".size(); ++" << i << ") {\n"
+				<< indent(level + 2) << "const boost::json::value& v_" << id << " = "
+				<< a << "[" << i << "];\n"
+				<< body.str();
+			code_ << indent(level + 1) << "}\n" << indent(level) << "}\n";
+			break;
+		}
+		case node::type::if_chain:
+			for (std::size_t b = 0; b < n.branches.size(); ++b) {
+				const auto& branch = n.branches[b];
+				if (b == 0)
+					code_ << indent(level) << "if (" << condition(branch.first) << ") {\n";
+				else if (!branch.first.empty())
+					code_ << indent(level) << "else if (" << condition(branch.first) << ") {\n";
+				else
+					code_ << indent(level) << "else {\n";
+				emit_nodes(branch.second, level + 1);
+				code_ << indent(level) << "}\n";
+			}
+			break;
+		case node::type::block: {
+			auto it = blocks_.find(n.value);
+			emit_nodes(it != blocks_.end() ? it->second->children : n.children, level);
+			break;
+		}
+		case node::type::extends:
+			throw unsupported_template{ "unresolved extends" };
+		}
+	}
+};
+
+std::string function_name(const std::string& file) {
+	std::string name = "render_";
+	for (char c : file)
+		name += std::isalnum(static_cast<unsigned char>(c)) ? c : '_';
+	return name;
+}
+
+int main(int argc, char* argv[]) {
+	if (argc != 3) {
+		std::cerr << "usage: " << argv[0] << " <template_root> <output.cpp>" << std::endl;
+		return EXIT_FAILURE;
+	}
+	std::filesystem::path root{ argv[1] };
+	std::vector<std::string> files;
+	for (const auto& entry : std::filesystem::directory_iterator(root)) {
+		std::string name = entry.path().filename().string();
+		if (entry.is_regular_file() && name.size() > 5
+			&& name.compare(name.size() - 5, 5, ".html") == 0)
+			files.push_back(name);
+	}
+	std::sort(files.begin(), files.end());
+
+	std::ostringstream functions;
+	std::vector<std::string> compiled;
+	for (const auto& file : files) {
+		try {
+			std::map<std::string, std::shared_ptr<node>> blocks;
+			node_list nodes = resolve(root, file, blocks);
+			std::string body = generator{ std::move(blocks) }.generate(nodes);
+			functions << "void " << function_name(file)
+				<< "(std::string& out, const boost::json::object& context) {\n"
+				<< body << "}\n\n";
+			compiled.push_back(file);
+		}
+		catch (const unsupported_template& e) {
+			std::cerr << "template_compiler: skipping " << file << ": " << e.what() << std::endl;
+		}
+	}
+
+	std::ofstream out{ argv[2], std::ios::binary };
+	out << "// generated by template_compiler from " << root.generic_string() << ", do not edit.\n\n"
+		<< "#include \"compiled_templates.h\"\n\n"
+		<< "#include <cstddef>\n"
+		<< "#include <unordered_map>\n\n"
+		<< "namespace {\n\n"
+		<< functions.str()
+		<< "} // namespace\n\n"
+		<< "compiled_template find_compiled_template(const std::string& template_file) {\n"
+		<< "\tstatic const std::unordered_map<std::string, compiled_template> templates{\n";
+	for (const auto& file : compiled)
+		out << "\t\t{ \"" << file << "\", &" << function_name(file) << " },\n";
+	out << "\t};\n"
+		<< "\tauto it = templates.find(template_file);\n"
+		<< "\treturn it == templates.end() ? nullptr : it->second;\n"
+		<< "}\n";
+	if (!out) {
+		std::cerr << "template_compiler: cannot write " << argv[2] << std::endl;
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}